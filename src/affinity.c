@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include "drivetemp.h"
+#include "iobuf.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int enabled = 0;
+static int iocpus[CPU_SETSIZE];
+static int niocpus = 0;
+static int housekeeping = -1;
+static int hkshared = 0; // no cpu left outside the io set
+static int mqordered = 0;
+static int memnode = AFFINITY_NODE_NONE;
+
+// "0-3,8,10-11" as in --cpus and sysfs cpulist files
+static int ParseCpuList(const char *str, cpu_set_t *set) {
+	char *end;
+	long a, b;
+
+	CPU_ZERO(set);
+	while (*str != '\0' && *str != '\n') {
+		a = strtol(str, &end, 10);
+		if (end == str || a < 0 || a >= CPU_SETSIZE)
+			return -1;
+		b = a;
+		if (*end == '-') {
+			str = end + 1;
+			b = strtol(str, &end, 10);
+			if (end == str || b < a || b >= CPU_SETSIZE)
+				return -1;
+		}
+		for (; a <= b; a++)
+			CPU_SET(a, set);
+		str = end;
+		if (*str == ',')
+			str++;
+		else if (*str != '\0' && *str != '\n')
+			return -1;
+	}
+	return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+static int ReadCpuList(const char *path, cpu_set_t *set) {
+	char buf[4096];
+	FILE *f;
+	int ret = -1;
+
+	f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	if (fgets(buf, sizeof(buf), f) != NULL)
+		ret = ParseCpuList(buf, set);
+	fclose(f);
+	return ret;
+}
+
+static int cmp_int(const void *a, const void *b) { return *(const int *)a - *(const int *)b; }
+
+// first unused io cpu of each hardware queue in queue order, then the rest
+static void OrderByQueues(const char *drv, cpu_set_t *io) {
+	char path[1024];
+	const char *root = getenv(DRIVETEMP_SYSFS_ENV);
+	const char *name = strrchr(drv, '/') != NULL ? strrchr(drv, '/') + 1 : drv;
+	int queues[CPU_SETSIZE];
+	int nqueues = 0, q, cpu;
+	cpu_set_t qset, used;
+	DIR *d;
+	struct dirent *ent;
+
+	if (root == NULL)
+		root = "/sys";
+	snprintf(path, sizeof(path), "%s/class/block/%s/mq", root, name);
+	d = opendir(path);
+	if (d != NULL) {
+		while ((ent = readdir(d)) != NULL && nqueues < CPU_SETSIZE)
+			if (ent->d_name[0] >= '0' && ent->d_name[0] <= '9')
+				queues[nqueues++] = atoi(ent->d_name);
+		closedir(d);
+	}
+	qsort(queues, nqueues, sizeof(int), cmp_int);
+
+	CPU_ZERO(&used);
+	niocpus = 0;
+	for (q = 0; q < nqueues; q++) {
+		snprintf(path, sizeof(path), "%s/class/block/%s/mq/%d/cpu_list", root, name, queues[q]);
+		if (ReadCpuList(path, &qset) != 0)
+			continue;
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &qset) && CPU_ISSET(cpu, io) && !CPU_ISSET(cpu, &used)) {
+				iocpus[niocpus++] = cpu;
+				CPU_SET(cpu, &used);
+				mqordered = 1;
+				break;
+			}
+		}
+	}
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, io) && !CPU_ISSET(cpu, &used))
+			iocpus[niocpus++] = cpu;
+	}
+}
+
+// cpus: --cpus list or NULL, numanode: node number, AFFINITY_NODE_DEVICE or AFFINITY_NODE_NONE.
+// the calling thread is moved into the io set, threads it starts inherit that until they pin themselves
+int affinity_init(const char *cpus, int numanode, const char *drv) {
+	cpu_set_t allowed, io;
+	char path[128];
+	int cpu;
+
+	if (cpus == NULL && numanode == AFFINITY_NODE_NONE)
+		return 0;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "sched_getaffinity failed");
+		return -1;
+	}
+
+	if (numanode == AFFINITY_NODE_DEVICE) {
+		numanode = iobuf_device_node(drv);
+		if (numanode < 0)
+			puts("device has no numa node, --numa-node auto ignored");
+	}
+	if (numanode >= 0) {
+		memnode = numanode;
+		iobuf_set_node(numanode);
+	}
+
+	if (cpus != NULL) {
+		if (ParseCpuList(cpus, &io) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "invalid --cpus list");
+			return -1;
+		}
+	} else if (numanode >= 0) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", numanode);
+		if (ReadCpuList(path, &io) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "can't read cpus of the numa node");
+			return -1;
+		}
+	} else {
+		return 0;
+	}
+	CPU_AND(&io, &io, &allowed);
+	if (CPU_COUNT(&io) == 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "no allowed cpu in the io set");
+		return -1;
+	}
+	OrderByQueues(drv, &io);
+
+	// housekeeping: first allowed cpu outside the io set, else the last io cpu
+	for (cpu = 0; cpu < CPU_SETSIZE && housekeeping < 0; cpu++)
+		if (CPU_ISSET(cpu, &allowed) && !CPU_ISSET(cpu, &io))
+			housekeeping = cpu;
+	if (housekeeping < 0) {
+		housekeeping = iocpus[niocpus - 1];
+		hkshared = 1;
+	}
+
+	enabled = 1;
+	if (pthread_setaffinity_np(pthread_self(), sizeof(io), &io) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread_setaffinity_np failed");
+		return -1;
+	}
+	return 0;
+}
+
+int affinity_enabled(void) { return enabled; }
+
+static void PinTo(int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// workers beyond the io set share cpus round robin
+void affinity_pin_io(int worker) {
+	if (enabled)
+		PinTo(iocpus[worker % niocpus]);
+}
+
+void affinity_pin_helper(void) {
+	if (enabled)
+		PinTo(housekeeping);
+}
+
+void affinity_print(void) {
+	int i;
+
+	if (memnode >= 0)
+		printf("Memory NUMA Node     = %d\n", memnode);
+	if (!enabled)
+		return;
+	printf("IO CPUs              = ");
+	for (i = 0; i < niocpus; i++)
+		printf("%s%d", i > 0 ? "," : "", iocpus[i]);
+	printf("%s\n", mqordered ? " (in blk-mq queue order)" : "");
+	printf("Housekeeping CPU     = %d%s\n", housekeeping, hkshared ? " (shared with io, no cpu left outside the io set)" : "");
+}
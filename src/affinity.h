@@ -0,0 +1,14 @@
+#pragma once
+
+#define AFFINITY_NODE_NONE -1
+#define AFFINITY_NODE_DEVICE -2 // --numa-node auto
+
+// IO threads get one cpu each from the io set, in the order of the device's blk-mq hardware queues so that
+// workers submit from cpus mapped to different completion vectors. helper threads (progress, logging,
+// temperature, trace writer, metrics) go to a housekeeping cpu outside the io set. all no-ops unless
+// affinity_init() was given --cpus or --numa-node
+int affinity_init(const char *cpus, int numanode, const char *drv);
+int affinity_enabled(void);
+void affinity_pin_io(int worker);
+void affinity_pin_helper(void);
+void affinity_print(void);
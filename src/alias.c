@@ -0,0 +1,80 @@
+#include "alias.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int alias_init(alias_table *t, const double *weights, uint32_t n) {
+	double sum, *scaled;
+	uint32_t *small, *large;
+	uint32_t i, ns, nl, s, l;
+
+	t->prob = NULL;
+	t->alias = NULL;
+	t->n = n;
+	sum = 0;
+	for (i = 0; i < n; i++) {
+		if (weights[i] < 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "negative weight");
+			return -1;
+		}
+		sum += weights[i];
+	}
+	if (n == 0 || sum <= 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "no positive weight");
+		return -1;
+	}
+
+	t->prob = malloc(sizeof(uint64_t) * n);
+	t->alias = malloc(sizeof(uint32_t) * n);
+	scaled = malloc(sizeof(double) * n);
+	small = malloc(sizeof(uint32_t) * n);
+	large = malloc(sizeof(uint32_t) * n);
+	if (t->prob == NULL || t->alias == NULL || scaled == NULL || small == NULL || large == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc failed");
+		return -1;
+	}
+
+	// columns with less than the average weight borrow the rest from one with more
+	ns = 0;
+	nl = 0;
+	for (i = 0; i < n; i++) {
+		scaled[i] = weights[i] * n / sum;
+		if (scaled[i] < 1.0)
+			small[ns++] = i;
+		else
+			large[nl++] = i;
+	}
+	while (ns > 0 && nl > 0) {
+		s = small[--ns];
+		l = large[nl - 1];
+		t->prob[s] = (uint64_t)(scaled[s] * 4294967296.0);
+		t->alias[s] = l;
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0) {
+			nl--;
+			small[ns++] = l;
+		}
+	}
+	// leftovers are 1.0 up to rounding
+	while (nl > 0) {
+		l = large[--nl];
+		t->prob[l] = 4294967296ULL;
+		t->alias[l] = l;
+	}
+	while (ns > 0) {
+		s = small[--ns];
+		t->prob[s] = 4294967296ULL;
+		t->alias[s] = s;
+	}
+
+	free(scaled);
+	free(small);
+	free(large);
+	return 0;
+}
+
+void alias_free(alias_table *t) {
+	free(t->prob);
+	free(t->alias);
+	t->prob = NULL;
+	t->alias = NULL;
+}
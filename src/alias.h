@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Walker/Vose alias table: O(n) setup, O(1) weighted pick from one 64 bit random number
+typedef struct {
+	uint32_t n;
+	uint64_t *prob; // keep own column if the low 32 bits are below this (2^32 = always)
+	uint32_t *alias;
+} alias_table;
+
+int alias_init(alias_table *t, const double *weights, uint32_t n);
+void alias_free(alias_table *t);
+
+static inline uint32_t alias_pick(const alias_table *t, uint64_t r) {
+	uint32_t col = (uint32_t)(((r >> 32) * t->n) >> 32);
+	return (r & 0xffffffffULL) < t->prob[col] ? col : t->alias[col];
+}
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include "analyze.h"
+#include "histogram.h"
+#include "ioengine.h"
+#include "tools.h"
+#include "trace.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// offline view of a --trace file: latency histograms, time series and an lba x time heatmap
+
+#define ANALYZE_CHUNK 4096 // records per fread
+
+typedef struct {
+	uint64_t ios_r;
+	uint64_t ios_w;
+	uint64_t bytes;
+	uint64_t latsum;
+	uint64_t latmax;
+} a_second;
+
+void init_analyze_params(analyze_params *p, char *tracepath, char *logfilepath) {
+	p->tracepath = tracepath;
+	p->logfilepath = logfilepath;
+}
+
+static void AddSecond(a_second *dst, a_second *src) {
+	dst->ios_r += src->ios_r;
+	dst->ios_w += src->ios_w;
+	dst->bytes += src->bytes;
+	dst->latsum += src->latsum;
+	if (src->latmax > dst->latmax)
+		dst->latmax = src->latmax;
+}
+
+static void PrintHeatmap(uint64_t (*heat)[ANALYZE_COLS], int rows, uint64_t secsperrow, uint64_t maxlba) {
+	const char *ramp = " .:-=+*#%@";
+	uint64_t max = 0;
+	int r, c, level;
+
+	for (r = 0; r < rows; r++)
+		for (c = 0; c < ANALYZE_COLS; c++)
+			if (heat[r][c] > max)
+				max = heat[r][c];
+	printf("\nLBA heatmap (columns: %d buckets of %" PRIu64 " sectors, rows: %" PRIu64 " s, darker = more IOs)\n", ANALYZE_COLS,
+		   maxlba / ANALYZE_COLS + 1, secsperrow);
+	for (r = 0; r < rows; r++) {
+		printf("%8" PRIu64 " |", r * secsperrow);
+		for (c = 0; c < ANALYZE_COLS; c++) {
+			level = heat[r][c] == 0 ? 0 : 1 + (int)(heat[r][c] * 8 / (max > 0 ? max : 1));
+			putchar(ramp[level > 9 ? 9 : level]);
+		}
+		puts("|");
+	}
+}
+
+int AnalyzeTrace(analyze_params *params) {
+	FILE *f, *flog;
+	trace_header hdr;
+	trace_record *recs;
+	histogram *hist_r, *hist_w;
+	a_second *secs, row;
+	uint64_t (*heat)[ANALYZE_COLS];
+	uint64_t nrecs = 0, maxts = 0, maxlba = 0, errors = 0, ios_r = 0, ios_w = 0, bytes_r = 0, bytes_w = 0;
+	uint64_t nsecs, secsperrow, s, sec;
+	size_t n, i;
+	int rows, r, col;
+	hms t;
+
+	f = fopen(params->tracepath, "r");
+	if (f == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fopen failed");
+		return -1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+		hdr.version != TRACE_VERSION || hdr.recsize != sizeof(trace_record)) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "not a trace file of this version");
+		fclose(f);
+		return -1;
+	}
+	recs = malloc(sizeof(trace_record) * ANALYZE_CHUNK);
+	hist_r = malloc(sizeof(histogram));
+	hist_w = malloc(sizeof(histogram));
+	if (recs == NULL || hist_r == NULL || hist_w == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc failed");
+		return -1;
+	}
+	hist_init(hist_r);
+	hist_init(hist_w);
+
+	// first pass for the extent in time and lba, records of different threads are not ordered
+	while ((n = fread(recs, sizeof(trace_record), ANALYZE_CHUNK, f)) > 0) {
+		for (i = 0; i < n; i++) {
+			if (recs[i].ts_ns > maxts)
+				maxts = recs[i].ts_ns;
+			if (recs[i].lba > maxlba)
+				maxlba = recs[i].lba;
+		}
+		nrecs += n;
+	}
+	if (nrecs == 0) {
+		puts("trace has no records");
+		fclose(f);
+		return 0;
+	}
+
+	nsecs = maxts / 1000 / 1000 / 1000 + 1;
+	secsperrow = (nsecs + ANALYZE_ROWS - 1) / ANALYZE_ROWS;
+	rows = (int)((nsecs + secsperrow - 1) / secsperrow);
+	secs = calloc(nsecs, sizeof(a_second));
+	heat = calloc(rows, sizeof(*heat));
+	if (secs == NULL || heat == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc failed");
+		return -1;
+	}
+
+	fseek(f, sizeof(hdr), SEEK_SET);
+	while ((n = fread(recs, sizeof(trace_record), ANALYZE_CHUNK, f)) > 0) {
+		for (i = 0; i < n; i++) {
+			sec = recs[i].ts_ns / 1000 / 1000 / 1000;
+			if (recs[i].err != 0) {
+				errors++;
+				continue;
+			}
+			if (recs[i].op == io_op_read) {
+				hist_record(hist_r, recs[i].lat_ns);
+				secs[sec].ios_r++;
+				ios_r++;
+				bytes_r += recs[i].len;
+			} else {
+				hist_record(hist_w, recs[i].lat_ns);
+				secs[sec].ios_w++;
+				ios_w++;
+				bytes_w += recs[i].len;
+			}
+			secs[sec].bytes += recs[i].len;
+			secs[sec].latsum += recs[i].lat_ns;
+			if (recs[i].lat_ns > secs[sec].latmax)
+				secs[sec].latmax = recs[i].lat_ns;
+			col = (int)(recs[i].lba * ANALYZE_COLS / (maxlba + 1));
+			heat[sec / secsperrow][col]++;
+		}
+	}
+	fclose(f);
+
+	t = getHMSfromMS(maxts / 1000 / 1000);
+	printf("Trace File           = %s\n", params->tracepath);
+	printf("Records              = %" PRIu64 "\n", nrecs);
+	printf("Duration             = %d h %d m %d s\n", t.h, t.m, t.s);
+	printf("Reads                = %" PRIu64 " (%.1f MB)\n", ios_r, (double)bytes_r / 1000 / 1000);
+	printf("Writes               = %" PRIu64 " (%.1f MB)\n", ios_w, (double)bytes_w / 1000 / 1000);
+	printf("Errors               = %" PRIu64 "\n", errors);
+	printf("Highest LBA          = %" PRIu64 "\n", maxlba);
+	if (ios_r > 0)
+		hist_print(hist_r, "Read  latency");
+	if (ios_w > 0)
+		hist_print(hist_w, "Write latency");
+
+	printf("\nTime[s]\tIOPS(R)\tIOPS(W)\tMB/s\tavg[us]\tmax[us]\n");
+	for (r = 0; r < rows; r++) {
+		memset(&row, 0, sizeof(row));
+		for (s = r * secsperrow; s < (uint64_t)(r + 1) * secsperrow && s < nsecs; s++)
+			AddSecond(&row, &secs[s]);
+		s -= r * secsperrow; // seconds in this row
+		printf("%" PRIu64 "\t%.0f\t%.0f\t%.2f\t%.1f\t%.1f\n", r * secsperrow, (double)row.ios_r / s, (double)row.ios_w / s,
+			   (double)row.bytes / 1000 / 1000 / s,
+			   row.ios_r + row.ios_w > 0 ? (double)row.latsum / (row.ios_r + row.ios_w) / 1000 : 0, (double)row.latmax / 1000);
+	}
+	PrintHeatmap(heat, rows, secsperrow, maxlba);
+
+	if (params->logfilepath != NULL) {
+		flog = fopen(params->logfilepath, "w");
+		if (flog == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fopen failed");
+			return -1;
+		}
+		fprintf(flog, "#Time[sec]\tIOs(R)\tIOs(W)\tMB/s\tavg[us]\tmax[us]\n");
+		for (s = 0; s < nsecs; s++)
+			fprintf(flog, "%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%.2f\t%.1f\t%.1f\n", s, secs[s].ios_r, secs[s].ios_w,
+					(double)secs[s].bytes / 1000 / 1000,
+					secs[s].ios_r + secs[s].ios_w > 0 ? (double)secs[s].latsum / (secs[s].ios_r + secs[s].ios_w) / 1000 : 0,
+					(double)secs[s].latmax / 1000);
+		fclose(flog);
+	}
+
+	free(recs);
+	free(hist_r);
+	free(hist_w);
+	free(secs);
+	free(heat);
+	return 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#define ANALYZE_ROWS 40 // time slices of the printed series and heatmap
+#define ANALYZE_COLS 64 // lba buckets of the heatmap
+
+typedef struct {
+	char *tracepath;
+	char *logfilepath; // per second series as tab separated values
+} analyze_params;
+
+void init_analyze_params(analyze_params *params, char *tracepath, char *logfilepath);
+int AnalyzeTrace(analyze_params *params);
@@ -0,0 +1,45 @@
+#include "compare.h"
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CMP_SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define CMP_SIMD_CLONES
+#endif
+
+// OR of all xor-ed words, zero when the sector matches. written as a plain
+// reduction so every clone of CompareSectors vectorizes it with its own register width
+static inline uint64_t SectorDiff(const uint64_t *restrict exp, const uint64_t *restrict act, uint64_t words) {
+	uint64_t i, acc = 0;
+	for (i = 0; i < words; i++)
+		acc |= exp[i] ^ act[i];
+	return acc;
+}
+
+static uint64_t SectorBitErrors(const uint64_t *exp, const uint64_t *act, uint64_t words) {
+	uint64_t i, n = 0;
+	for (i = 0; i < words; i++)
+		n += (uint64_t)__builtin_popcountll(exp[i] ^ act[i]);
+	return n;
+}
+
+// scan len bytes sector by sector in one pass. the first maxout mismatching sectors are
+// stored in out with their bit error count, the return value is the total number of them
+CMP_SIMD_CLONES
+uint64_t CompareSectors(const uint64_t *exp, const uint64_t *act, uint64_t len, uint64_t sectorsize, sector_mismatch *out,
+						uint64_t maxout) {
+	uint64_t s, nsectors, words, found = 0;
+
+	words = sectorsize / sizeof(uint64_t);
+	nsectors = len / sectorsize;
+	for (s = 0; s < nsectors; s++) {
+		if (SectorDiff(exp + s * words, act + s * words, words) == 0)
+			continue;
+		if (found < maxout) {
+			out[found].sector = s;
+			out[found].biterrors = SectorBitErrors(exp + s * words, act + s * words, words);
+		}
+		found++;
+	}
+	return found;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+	uint64_t sector;    // sector index from the start of the scanned range
+	uint64_t biterrors; // number of flipped bits in the sector
+} sector_mismatch;
+
+uint64_t CompareSectors(const uint64_t *exp, const uint64_t *act, uint64_t len, uint64_t sectorsize, sector_mismatch *out,
+						uint64_t maxout);
@@ -0,0 +1,118 @@
+#include "crc32c.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+// crc32c (castagnoli, reflected 0x82f63b78) as used by iscsi, ext4 and btrfs.
+// crc32c(0, buf, len) starts a new checksum, passing the previous result continues it
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+static uint32_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void InitTable(void) {
+	uint32_t i, j, c;
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+		table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+}
+
+// slicing-by-8, little endian only
+static uint32_t Crc32cTable(uint32_t crc, const unsigned char *p, size_t len) {
+	uint64_t w;
+	pthread_once(&table_once, InitTable);
+	while (len > 0 && ((uintptr_t)p & 7) != 0) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+		len--;
+	}
+	while (len >= 8) {
+		memcpy(&w, p, 8);
+		w ^= crc;
+		crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^ table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff] ^
+			  table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^ table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+		len--;
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t Crc32cHW(uint32_t crc, const unsigned char *p, size_t len) {
+	uint64_t w, c = crc;
+	while (len > 0 && ((uintptr_t)p & 7) != 0) {
+		c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+		len--;
+	}
+	while (len >= 8) {
+		memcpy(&w, p, 8);
+		c = __builtin_ia32_crc32di(c, w);
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+		len--;
+	}
+	return (uint32_t)c;
+}
+
+static int HasHW(void) {
+	static int hw = -1;
+	if (hw == -1)
+		hw = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+	return hw;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t Crc32cHW(uint32_t crc, const unsigned char *p, size_t len) {
+	uint64_t w;
+	while (len >= 8) {
+		memcpy(&w, p, 8);
+		crc = __crc32cd(crc, w);
+		p += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		crc = __crc32cb(crc, *p++);
+		len--;
+	}
+	return crc;
+}
+
+static int HasHW(void) { return 1; }
+#else
+static uint32_t Crc32cHW(uint32_t crc, const unsigned char *p, size_t len) { return Crc32cTable(crc, p, len); }
+
+static int HasHW(void) { return 0; }
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+	crc = ~crc;
+	if (HasHW())
+		crc = Crc32cHW(crc, buf, len);
+	else
+		crc = Crc32cTable(crc, buf, len);
+	return ~crc;
+}
+
+const char *crc32c_impl(void) {
+#if defined(__x86_64__)
+	return HasHW() ? "sse4.2" : "table";
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	return "armv8 crc";
+#else
+	return "table";
+#endif
+}
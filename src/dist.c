@@ -0,0 +1,197 @@
+#include "dist.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline double uniform01(pcg32x2_random_t *rng) { return (double)(pcg32x2_random_r(rng) >> 11) * 0x1.0p-53; }
+
+// "zipf:1.2", "pareto:0.9", "zoned:60/10:30/20:10/70" (access%/size% per zone, from LBA 0)
+int dist_parse(const char *str, dist_spec *spec) {
+	char *endptr;
+	double access, size, sumaccess, sumsize;
+
+	memset(spec, 0, sizeof(dist_spec));
+	if (strcmp(str, "uniform") == 0) {
+		spec->type = dist_uniform;
+		return 0;
+	}
+	if (strncmp(str, "zipf:", 5) == 0) {
+		spec->type = dist_zipf;
+		spec->param = strtod(str + 5, &endptr);
+		return str[5] != '\0' && *endptr == '\0' && spec->param > 0 ? 0 : -1;
+	}
+	if (strncmp(str, "pareto:", 7) == 0) {
+		spec->type = dist_pareto;
+		spec->param = strtod(str + 7, &endptr);
+		return str[7] != '\0' && *endptr == '\0' && spec->param > 0 && spec->param < 1 ? 0 : -1;
+	}
+	if (strncmp(str, "zoned:", 6) == 0) {
+		spec->type = dist_zoned;
+		str += 5;
+		sumaccess = 0;
+		sumsize = 0;
+		while (*str == ':') {
+			if (spec->nzones == DIST_MAX_ZONES)
+				return -1;
+			access = strtod(str + 1, &endptr);
+			if (endptr == str + 1 || *endptr != '/')
+				return -1;
+			str = endptr + 1;
+			size = strtod(str, &endptr);
+			if (endptr == str || access < 0 || size <= 0)
+				return -1;
+			str = endptr;
+			spec->zoneaccess[spec->nzones] = access;
+			spec->zonesize[spec->nzones] = size;
+			spec->nzones++;
+			sumaccess += access;
+			sumsize += size;
+		}
+		if (*str != '\0' || spec->nzones == 0 || fabs(sumaccess - 100) > 0.001 || fabs(sumsize - 100) > 0.001)
+			return -1;
+		return 0;
+	}
+	return -1;
+}
+
+void dist_name(const dist_spec *spec, char *buf, int len) {
+	int i, n;
+	switch (spec->type) {
+		case dist_zipf:
+			snprintf(buf, len, "zipf:%g", spec->param);
+			break;
+		case dist_pareto:
+			snprintf(buf, len, "pareto:%g", spec->param);
+			break;
+		case dist_zoned:
+			n = snprintf(buf, len, "zoned");
+			for (i = 0; i < spec->nzones && n < len; i++)
+				n += snprintf(buf + n, len - n, ":%g/%g", spec->zoneaccess[i], spec->zonesize[i]);
+			break;
+		default:
+			snprintf(buf, len, "uniform");
+			break;
+	}
+}
+
+// expm1(x) / x and log1p(x) / x, well defined around 0
+static double helper1(double x) { return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x)); }
+static double helper2(double x) { return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x)); }
+
+// integral of x^-theta and its inverse, shifted so that theta == 1 needs no special case
+static double zipf_H(double theta, double x) {
+	double lx = log(x);
+	return helper2((1 - theta) * lx) * lx;
+}
+
+static double zipf_Hinv(double theta, double x) {
+	double t = x * (1 - theta);
+	if (t < -1)
+		t = -1; // limit of numerical accuracy
+	return exp(helper1(t) * x);
+}
+
+static double zipf_h(double theta, double x) { return exp(-theta * log(x)); }
+
+static uint64_t gcd_u64(uint64_t a, uint64_t b) {
+	uint64_t t;
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+int dist_init(dist_sampler *d, const dist_spec *spec, uint64_t n) {
+	double w[DIST_MAX_ZONES], pos;
+	uint64_t end;
+	int i;
+
+	memset(d, 0, sizeof(dist_sampler));
+	d->spec = *spec;
+	d->n = n;
+	if (n == 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "no block to pick");
+		return -1;
+	}
+	switch (spec->type) {
+		case dist_zipf:
+			d->hx1 = zipf_H(spec->param, 1.5) - 1;
+			d->hn = zipf_H(spec->param, (double)n + 0.5);
+			d->sv = 2 - zipf_Hinv(spec->param, zipf_H(spec->param, 2.5) - zipf_h(spec->param, 2));
+			break;
+		case dist_pareto:
+			d->paretopow = log(spec->param) / log(1 - spec->param);
+			break;
+		case dist_zoned:
+			// zone boundaries in blocks, the last one takes the rounding rest
+			pos = 0;
+			for (i = 0; i < spec->nzones; i++) {
+				d->zonestart[i] = (uint64_t)(pos / 100 * (double)n);
+				pos += spec->zonesize[i];
+				end = i == spec->nzones - 1 ? n : (uint64_t)(pos / 100 * (double)n);
+				d->zonelen[i] = end > d->zonestart[i] ? end - d->zonestart[i] : 0;
+				w[i] = d->zonelen[i] > 0 ? spec->zoneaccess[i] : 0;
+			}
+			if (alias_init(&d->zones, w, (uint32_t)spec->nzones) != 0) {
+				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "zones have no blocks to access");
+				return -1;
+			}
+			break;
+		default:
+			break;
+	}
+	// any a coprime to n makes rank -> block a bijection, a single block has nothing to scatter
+	if (n == 1) {
+		d->a = 1;
+		d->b = 0;
+		return 0;
+	}
+	d->a = 0x9e3779b97f4a7c15ULL % n;
+	while (d->a == 0 || gcd_u64(d->a, n) != 1)
+		d->a = (d->a + 1) % n;
+	d->b = 0x632be59bd9b4e019ULL % n;
+	return 0;
+}
+
+void dist_free(dist_sampler *d) {
+	if (d->spec.type == dist_zoned)
+		alias_free(&d->zones);
+}
+
+static inline uint64_t scatter(const dist_sampler *d, uint64_t rank) {
+	return (uint64_t)(((unsigned __int128)rank * d->a + d->b) % d->n);
+}
+
+// block index in [0, n)
+uint64_t dist_next(const dist_sampler *d, pcg32x2_random_t *rng) {
+	double u, x;
+	uint64_t k;
+	uint32_t z;
+
+	switch (d->spec.type) {
+		case dist_zipf:
+			// expected number of rounds is close to 1 for any theta
+			while (1) {
+				u = d->hn + uniform01(rng) * (d->hx1 - d->hn);
+				x = zipf_Hinv(d->spec.param, u);
+				k = (uint64_t)(x + 0.5);
+				if (k < 1)
+					k = 1;
+				else if (k > d->n)
+					k = d->n;
+				if ((double)k - x <= d->sv || u >= zipf_H(d->spec.param, (double)k + 0.5) - zipf_h(d->spec.param, (double)k))
+					return scatter(d, k - 1);
+			}
+		case dist_pareto:
+			k = (uint64_t)((double)(d->n - 1) * pow(uniform01(rng), d->paretopow));
+			return scatter(d, d->n - 1 - k);
+		case dist_zoned:
+			z = alias_pick(&d->zones, pcg32x2_random_r(rng));
+			return d->zonestart[z] + pcg32x2_boundedrand_r(rng, d->zonelen[z]);
+		default:
+			return pcg32x2_boundedrand_r(rng, d->n);
+	}
+}
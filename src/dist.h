@@ -0,0 +1,45 @@
+#pragma once
+
+#include "alias.h"
+#include "rng.h"
+#include <stdint.h>
+
+// block selection for random access, uniform or skewed to a hot set
+
+#define DIST_MAX_ZONES 16
+
+typedef enum { //
+	dist_uniform,
+	dist_zipf,
+	dist_pareto,
+	dist_zoned
+} dist_type;
+
+typedef struct {
+	dist_type type;
+	double param; // zipf: theta, pareto: h
+	int nzones;
+	double zoneaccess[DIST_MAX_ZONES]; // percent of accesses
+	double zonesize[DIST_MAX_ZONES];   // percent of blocks
+} dist_spec;
+
+typedef struct {
+	dist_spec spec;
+	uint64_t n;
+	// zipf, rejection-inversion (Hormann & Derflinger)
+	double hx1, hn, sv;
+	// pareto
+	double paretopow;
+	// zipf and pareto ranks are scattered over the blocks by rank * a + b mod n
+	uint64_t a, b;
+	// zoned
+	alias_table zones;
+	uint64_t zonestart[DIST_MAX_ZONES];
+	uint64_t zonelen[DIST_MAX_ZONES];
+} dist_sampler;
+
+int dist_parse(const char *str, dist_spec *spec);
+void dist_name(const dist_spec *spec, char *buf, int len);
+int dist_init(dist_sampler *d, const dist_spec *spec, uint64_t n);
+void dist_free(dist_sampler *d);
+uint64_t dist_next(const dist_sampler *d, pcg32x2_random_t *rng);
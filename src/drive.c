@@ -10,29 +10,6 @@
 //#define __USE_GNU
 #include <fcntl.h>
 
-int getDriveTemp(char *drv, int *ret) {
-	FILE *fd;
-	char cmd[128];
-	char buf[128];
-
-	*ret = -99;
-
-	snprintf(cmd, sizeof(cmd), "smartctl -A %s | awk \'$1 == 194 {print $10}\'", drv);
-
-	fd = popen(cmd, "r");
-	if (fd == NULL) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __FUNCTION__, "popen failed");
-		return -1;
-	}
-
-	while (fgets(buf, sizeof(buf), fd) != NULL) {
-		*ret = atoi(buf);
-	}
-	pclose(fd);
-
-	return 0;
-}
-
 int getDriveSize(char *drv, uint64_t *ret) {
 	int fd;
 
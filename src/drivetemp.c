@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include "drivetemp.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/nvme_ioctl.h>
+#include <scsi/sg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// drive temperature without forking: hwmon sysfs (nvme, drivetemp), nvme smart log, ata smart read data.
+// smartctl is only the last resort for drives none of these understand
+
+#define SMART_LOG_SIZE 512
+
+// first temp1_input below dir/hwmon*/ or dir/hwmon/hwmon*/
+static int OpenHwmonIn(const char *dir) {
+	char path[1024];
+	DIR *d;
+	struct dirent *ent;
+	int fd = -1;
+
+	d = opendir(dir);
+	if (d == NULL)
+		return -1;
+	while (fd < 0 && (ent = readdir(d)) != NULL) {
+		if (strncmp(ent->d_name, "hwmon", 5) != 0)
+			continue;
+		if (strcmp(ent->d_name, "hwmon") == 0) {
+			snprintf(path, sizeof(path), "%s/hwmon", dir);
+			fd = OpenHwmonIn(path);
+		} else {
+			snprintf(path, sizeof(path), "%s/%s/temp1_input", dir, ent->d_name);
+			fd = open(path, O_RDONLY);
+		}
+	}
+	closedir(d);
+	return fd;
+}
+
+// <root>/class/block/<name>/device is the nvme controller or the scsi disk, a partition looks at its parent
+static int OpenHwmon(const char *drv) {
+	char path[1024];
+	const char *root = getenv(DRIVETEMP_SYSFS_ENV);
+	const char *name = strrchr(drv, '/') != NULL ? strrchr(drv, '/') + 1 : drv;
+	struct stat st;
+
+	if (root == NULL)
+		root = "/sys";
+	snprintf(path, sizeof(path), "%s/class/block/%s/partition", root, name);
+	if (stat(path, &st) == 0)
+		snprintf(path, sizeof(path), "%s/class/block/%s/../device", root, name);
+	else
+		snprintf(path, sizeof(path), "%s/class/block/%s/device", root, name);
+	return OpenHwmonIn(path);
+}
+
+static int ReadHwmon(drivetemp *s, int *celsius) {
+	char buf[32];
+	ssize_t len;
+
+	len = pread(s->fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+	*celsius = atoi(buf) / 1000; // millidegree
+	return 0;
+}
+
+// get log page 02h, composite temperature in kelvin at byte 1
+static int ReadNvme(drivetemp *s, int *celsius) {
+	uint8_t log[SMART_LOG_SIZE];
+	struct nvme_admin_cmd cmd;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.opcode = 0x02;
+	cmd.nsid = 0xffffffff;
+	cmd.addr = (uint64_t)(uintptr_t)log;
+	cmd.data_len = sizeof(log);
+	cmd.cdw10 = 0x02 | ((sizeof(log) / 4 - 1) << 16);
+	if (ioctl(s->fd, NVME_IOCTL_ADMIN_CMD, &cmd) != 0)
+		return -1;
+	if ((log[1] | log[2] << 8) == 0)
+		return -1;
+	*celsius = (log[1] | log[2] << 8) - 273;
+	return 0;
+}
+
+// SMART READ DATA through ATA PASS-THROUGH(16), attribute 194 or else 190, current value in raw byte 0
+static int ReadAta(drivetemp *s, int *celsius) {
+	uint8_t data[SMART_LOG_SIZE];
+	uint8_t cdb[16] = {0x85, 4 << 1, 0x0e, 0, 0xd0, 0, 1, 0, 0, 0, 0x4f, 0, 0xc2, 0, 0xb0, 0};
+	uint8_t sense[32];
+	uint8_t *attr;
+	struct sg_io_hdr io;
+	int i, found = 0;
+
+	memset(&io, 0, sizeof(io));
+	io.interface_id = 'S';
+	io.dxfer_direction = SG_DXFER_FROM_DEV;
+	io.cmd_len = sizeof(cdb);
+	io.cmdp = cdb;
+	io.mx_sb_len = sizeof(sense);
+	io.sbp = sense;
+	io.dxfer_len = sizeof(data);
+	io.dxferp = data;
+	io.timeout = 3000;
+	if (ioctl(s->fd, SG_IO, &io) != 0 || io.status != 0 || io.host_status != 0 || (io.driver_status & 0x0f) != 0)
+		return -1;
+	for (i = 0; i < 30; i++) {
+		attr = &data[2 + i * 12];
+		if (attr[0] == 194 || (attr[0] == 190 && !found)) {
+			*celsius = attr[5];
+			found = attr[0];
+		}
+	}
+	return found ? 0 : -1;
+}
+
+static int ReadSmartctl(drivetemp *s, int *celsius) {
+	FILE *fd;
+	char cmd[320];
+	char buf[128];
+	int found = -1;
+
+	snprintf(cmd, sizeof(cmd), "smartctl -A %s 2>/dev/null | awk \'$1 == 194 {print $10}\'", s->drv);
+	fd = popen(cmd, "r");
+	if (fd == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "popen failed");
+		return -1;
+	}
+	while (fgets(buf, sizeof(buf), fd) != NULL) {
+		*celsius = atoi(buf);
+		found = 0;
+	}
+	pclose(fd);
+	return found;
+}
+
+static int ReadFrom(drivetemp *s, int *celsius) {
+	switch (s->src) {
+		case drivetemp_hwmon:
+			return ReadHwmon(s, celsius);
+		case drivetemp_nvme:
+			return ReadNvme(s, celsius);
+		case drivetemp_ata:
+			return ReadAta(s, celsius);
+		case drivetemp_smartctl:
+			return ReadSmartctl(s, celsius);
+		default:
+			return -1;
+	}
+}
+
+// always succeeds, s->src is drivetemp_none when the drive has no readable sensor
+int drivetemp_open(drivetemp *s, const char *drv) {
+	const char *name = strrchr(drv, '/') != NULL ? strrchr(drv, '/') + 1 : drv;
+	int t;
+
+	memset(s, 0, sizeof(drivetemp));
+	snprintf(s->drv, sizeof(s->drv), "%s", drv);
+	s->fd = OpenHwmon(drv);
+	s->src = drivetemp_hwmon;
+	if (s->fd >= 0 && ReadFrom(s, &t) == 0)
+		return 0;
+	if (s->fd >= 0)
+		close(s->fd);
+
+	s->fd = open(drv, O_RDONLY | O_NONBLOCK);
+	if (s->fd >= 0) {
+		s->src = strncmp(name, "nvme", 4) == 0 ? drivetemp_nvme : drivetemp_ata;
+		if (ReadFrom(s, &t) == 0)
+			return 0;
+		close(s->fd);
+	}
+
+	s->fd = -1;
+	s->src = drivetemp_smartctl;
+	if (ReadFrom(s, &t) == 0)
+		return 0;
+	s->src = drivetemp_none;
+	return 0;
+}
+
+// DRIVETEMP_NONE if there is no sensor or the read failed
+int drivetemp_read(drivetemp *s, int *celsius) {
+	*celsius = DRIVETEMP_NONE;
+	if (s->src == drivetemp_none)
+		return 0;
+	if (ReadFrom(s, celsius) != 0)
+		*celsius = DRIVETEMP_NONE;
+	return 0;
+}
+
+void drivetemp_close(drivetemp *s) {
+	if (s->fd >= 0)
+		close(s->fd);
+	s->fd = -1;
+	s->src = drivetemp_none;
+}
+
+const char *drivetemp_name(drivetemp_source src) {
+	switch (src) {
+		case drivetemp_hwmon:
+			return "hwmon";
+		case drivetemp_nvme:
+			return "nvme smart log";
+		case drivetemp_ata:
+			return "ata smart";
+		case drivetemp_smartctl:
+			return "smartctl";
+		default:
+			return "none";
+	}
+}
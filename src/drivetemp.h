@@ -0,0 +1,24 @@
+#pragma once
+
+#define DRIVETEMP_NONE -99
+#define DRIVETEMP_SYSFS_ENV "DISKEXP_SYSFS_ROOT" // replaces /sys, e.g. a fake tree for testing
+
+typedef enum { //
+	drivetemp_hwmon,
+	drivetemp_nvme,
+	drivetemp_ata,
+	drivetemp_smartctl,
+	drivetemp_none
+} drivetemp_source;
+
+// the source is probed once by drivetemp_open(), each drivetemp_read() is then a single pread or ioctl
+typedef struct {
+	drivetemp_source src;
+	int fd; // hwmon temp1_input or the device itself
+	char drv[256];
+} drivetemp;
+
+int drivetemp_open(drivetemp *s, const char *drv);
+int drivetemp_read(drivetemp *s, int *celsius);
+void drivetemp_close(drivetemp *s);
+const char *drivetemp_name(drivetemp_source src);
@@ -0,0 +1,84 @@
+#include "histogram.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+static inline unsigned hist_index(uint64_t v) {
+	unsigned msb;
+	if (v < (1u << HIST_SUB_BITS))
+		return (unsigned)v;
+	msb = 63 - (unsigned)__builtin_clzll(v);
+	return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (unsigned)((v >> (msb - HIST_SUB_BITS)) - (1u << HIST_SUB_BITS));
+}
+
+// highest value that falls into bucket idx
+static inline uint64_t hist_value(unsigned idx) {
+	unsigned shift;
+	if (idx < (1u << HIST_SUB_BITS))
+		return idx;
+	shift = (idx >> HIST_SUB_BITS) - 1;
+	return (((uint64_t)(idx & ((1u << HIST_SUB_BITS) - 1)) + (1u << HIST_SUB_BITS) + 1) << shift) - 1;
+}
+
+void hist_init(histogram *h) { memset(h, 0, sizeof(histogram)); }
+
+// lock-free: only the owning thread records, readers take relaxed snapshots
+void hist_record(histogram *h, uint64_t value) {
+	unsigned idx = hist_index(value);
+	atomic_store_explicit(&h->buckets[idx], h->buckets[idx] + 1, memory_order_relaxed);
+	atomic_store_explicit(&h->count, h->count + 1, memory_order_relaxed);
+	if (value > h->max)
+		atomic_store_explicit(&h->max, value, memory_order_relaxed);
+}
+
+void hist_merge(histogram *dst, histogram *src) {
+	unsigned i;
+	uint64_t max = atomic_load_explicit(&src->max, memory_order_relaxed);
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += atomic_load_explicit(&src->buckets[i], memory_order_relaxed);
+	dst->count += atomic_load_explicit(&src->count, memory_order_relaxed);
+	if (max > dst->max)
+		dst->max = max;
+}
+
+// dst = now - prev, max becomes the top of the highest non-empty bucket
+void hist_diff(histogram *dst, histogram *now, histogram *prev) {
+	unsigned i;
+	dst->count = 0;
+	dst->max = 0;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		dst->buckets[i] = now->buckets[i] - prev->buckets[i];
+		dst->count += dst->buckets[i];
+		if (dst->buckets[i] != 0)
+			dst->max = hist_value(i);
+	}
+	if (dst->max > now->max)
+		dst->max = now->max;
+}
+
+uint64_t hist_percentile(histogram *h, double pct) {
+	uint64_t target, sum = 0;
+	unsigned i;
+	if (h->count == 0)
+		return 0;
+	target = (uint64_t)(pct / 100 * h->count + 0.5);
+	if (target < 1)
+		target = 1;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		sum += h->buckets[i];
+		if (sum >= target)
+			return hist_value(i) < h->max ? hist_value(i) : h->max;
+	}
+	return h->max;
+}
+
+// values are recorded in ns and shown in us
+void hist_print(histogram *h, const char *label) {
+	printf("%s p50    : %.1f us\n", label, (double)hist_percentile(h, 50) / 1000);
+	printf("%s p90    : %.1f us\n", label, (double)hist_percentile(h, 90) / 1000);
+	printf("%s p99    : %.1f us\n", label, (double)hist_percentile(h, 99) / 1000);
+	printf("%s p99.9  : %.1f us\n", label, (double)hist_percentile(h, 99.9) / 1000);
+	printf("%s p99.99 : %.1f us\n", label, (double)hist_percentile(h, 99.99) / 1000);
+	printf("%s max    : %.1f us\n", label, (double)h->max / 1000);
+}
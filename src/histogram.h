@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+// log-linear latency histogram (HDR style): 2^HIST_SUB_BITS linear buckets per power of two,
+// so every recorded value is kept within ~3% relative error with a fixed memory footprint
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct {
+	uint64_t count;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+} histogram;
+
+void hist_init(histogram *h);
+void hist_record(histogram *h, uint64_t value);
+void hist_merge(histogram *dst, histogram *src);
+void hist_diff(histogram *dst, histogram *now, histogram *prev);
+uint64_t hist_percentile(histogram *h, double pct);
+void hist_print(histogram *h, const char *label);
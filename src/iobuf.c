@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+#include "iobuf.h"
+#include "drivetemp.h"
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// mbind() without libnuma
+#define IOBUF_MPOL_PREFERRED 1
+#define IOBUF_MPOL_MF_MOVE (1 << 1)
+#define IOBUF_MAX_NODES 1024
+
+static int forcednode = -1; // --numa-node instead of the device's node
+
+static uint64_t RoundUp(uint64_t size) { return (size + IOBUF_ALIGN - 1) / IOBUF_ALIGN * IOBUF_ALIGN; }
+
+// numa_node of the first ancestor of the block device in sysfs that has one (the pci function), -1 if unknown
+int iobuf_device_node(const char *drv) {
+	char path[PATH_MAX + 16], real[PATH_MAX], buf[16];
+	const char *root = getenv(DRIVETEMP_SYSFS_ENV);
+	const char *name = strrchr(drv, '/') != NULL ? strrchr(drv, '/') + 1 : drv;
+	char *p;
+	FILE *f;
+	int node;
+
+	if (root == NULL)
+		root = "/sys";
+	snprintf(path, sizeof(path), "%s/class/block/%s", root, name);
+	if (realpath(path, real) == NULL)
+		return -1;
+	while ((p = strrchr(real, '/')) != NULL && p != real) {
+		snprintf(path, sizeof(path), "%s/numa_node", real);
+		f = fopen(path, "r");
+		if (f != NULL) {
+			node = -1;
+			if (fgets(buf, sizeof(buf), f) != NULL)
+				node = atoi(buf);
+			fclose(f);
+			return node;
+		}
+		*p = '\0';
+	}
+	return -1;
+}
+
+// mmap gives only page alignment, cut the mapping down to an aligned window
+static void *MapAligned(uint64_t size) {
+	char *p, *aligned;
+	uint64_t head;
+
+	p = mmap(NULL, size + IOBUF_ALIGN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	aligned = (char *)(((uintptr_t)p + IOBUF_ALIGN - 1) & ~((uintptr_t)IOBUF_ALIGN - 1));
+	head = (uint64_t)(aligned - p);
+	if (head > 0)
+		munmap(p, head);
+	munmap(aligned + size, IOBUF_ALIGN - head);
+	return aligned;
+}
+
+void *iobuf_alloc(const char *drv, uint64_t size) {
+	unsigned long mask[IOBUF_MAX_NODES / (8 * sizeof(unsigned long))];
+	const char *kind;
+	char where[32];
+	char *p;
+	uint64_t i;
+	int node, bound = 0, locked;
+
+	size = RoundUp(size);
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+		kind = "huge pages";
+	} else {
+		p = MapAligned(size);
+		if (p == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mmap failed");
+			return NULL;
+		}
+		kind = madvise(p, size, MADV_HUGEPAGE) == 0 ? "transparent huge pages" : "normal pages";
+	}
+
+	// before the first touch, so pages are allocated on the node right away; preferred rather than bound, a full node
+	// falls back to other nodes instead of OOM or SIGBUS on the touch below
+	node = forcednode >= 0 ? forcednode : drv != NULL ? iobuf_device_node(drv) : -1;
+	if (node >= 0 && node < IOBUF_MAX_NODES) {
+		memset(mask, 0, sizeof(mask));
+		mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+		bound = syscall(__NR_mbind, p, size, IOBUF_MPOL_PREFERRED, mask, IOBUF_MAX_NODES, IOBUF_MPOL_MF_MOVE) == 0;
+	}
+
+	// mlock faults everything in, without the limit touching every page does it
+	locked = mlock(p, size) == 0;
+	if (!locked)
+		for (i = 0; i < size; i += 4096)
+			p[i] = 0;
+
+	if (bound)
+		snprintf(where, sizeof(where), "numa node %d preferred", node);
+	else
+		snprintf(where, sizeof(where), "no numa binding");
+	printf("IO Buffer            = %" PRIu64 " MiB, %s, %s, %s\n", size / 1024 / 1024, kind, where,
+		   locked ? "locked" : "not locked (RLIMIT_MEMLOCK)");
+	return p;
+}
+
+void iobuf_set_node(int node) { forcednode = node; }
+
+void iobuf_free(void *buf, uint64_t size) {
+	if (buf == NULL)
+		return;
+	size = RoundUp(size);
+	munlock(buf, size);
+	munmap(buf, size);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+#define IOBUF_ALIGN (2 * 1024 * 1024) // huge page size, also keeps O_DIRECT alignment
+
+// large IO buffers for all modes: explicit huge pages if reserved, else transparent huge pages, else normal
+// pages; bound to the NUMA node of the device's PCIe slot, locked and faulted in before any timing starts
+void *iobuf_alloc(const char *drv, uint64_t size);
+void iobuf_free(void *buf, uint64_t size);
+int iobuf_device_node(const char *drv);
+void iobuf_set_node(int node);
@@ -0,0 +1,592 @@
+#define _GNU_SOURCE
+#define _LARGEFILE64_SOURCE
+#include "ioengine.h"
+#include "tools.h"
+#include "uring.h"
+#include <errno.h>
+#include <linux/aio_abi.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+// sync / psync: requests are batched on queue and executed one by one on submit
+
+typedef struct {
+	io_op op;
+	void *buf;
+	uint64_t len;
+	uint64_t offset;
+	uint64_t tag;
+} sync_req;
+
+typedef struct {
+	sync_req *reqs;
+	io_event *done;
+	unsigned ndone;
+	uint64_t pos; // current file position (sync only)
+} sync_priv;
+
+static int sync_init(ioengine *e) {
+	sync_priv *p = calloc(1, sizeof(sync_priv));
+	if (p == NULL)
+		return -1;
+	p->reqs = calloc(e->depth, sizeof(sync_req));
+	p->done = calloc(e->depth, sizeof(io_event));
+	if (p->reqs == NULL || p->done == NULL) {
+		free(p->reqs);
+		free(p->done);
+		free(p);
+		return -1;
+	}
+	p->pos = (uint64_t)lseek64(e->fd, 0, SEEK_CUR);
+	e->priv = p;
+	return 0;
+}
+
+static int sync_register_buffers(ioengine *e, struct iovec *iov, unsigned nr) {
+	(void)e;
+	(void)iov;
+	(void)nr;
+	return 0;
+}
+
+static int sync_queue(ioengine *e, io_op op, void *buf, uint64_t len, uint64_t offset, uint64_t tag) {
+	sync_priv *p = e->priv;
+	sync_req *r = &p->reqs[e->queued];
+	r->op = op;
+	r->buf = buf;
+	r->len = len;
+	r->offset = offset;
+	r->tag = tag;
+	return 0;
+}
+
+// RWF_HIPRI asks the block layer to poll for the completion instead of sleeping until the interrupt,
+// offset -1 uses and advances the file position like read()/write()
+static ssize_t sync_rw(ioengine *e, sync_req *r, off_t offset) {
+	struct iovec iov;
+	if (e->flags & IOENGINE_HIPRI) {
+		iov.iov_base = r->buf;
+		iov.iov_len = r->len;
+		if (r->op == io_op_write)
+			return pwritev2(e->fd, &iov, 1, offset, RWF_HIPRI);
+		return preadv2(e->fd, &iov, 1, offset, RWF_HIPRI);
+	}
+	if (offset == -1)
+		return r->op == io_op_write ? write(e->fd, r->buf, r->len) : read(e->fd, r->buf, r->len);
+	return r->op == io_op_write ? pwrite(e->fd, r->buf, r->len, offset) : pread(e->fd, r->buf, r->len, offset);
+}
+
+static int sync_submit(ioengine *e) {
+	sync_priv *p = e->priv;
+	sync_req *r;
+	ssize_t ret;
+	unsigned i;
+
+	for (i = 0; i < e->queued; i++) {
+		r = &p->reqs[i];
+		if (e->type == ioengine_psync) {
+			ret = sync_rw(e, r, (off_t)r->offset);
+		} else {
+			if (p->pos != r->offset) {
+				if (lseek64(e->fd, r->offset, SEEK_SET) == -1)
+					return -1;
+				p->pos = r->offset;
+			}
+			ret = sync_rw(e, r, -1);
+			if (ret > 0)
+				p->pos += ret;
+		}
+		p->done[p->ndone].tag = r->tag;
+		p->done[p->ndone].res = ret < 0 ? -errno : ret;
+		p->ndone++;
+	}
+	return (int)i;
+}
+
+static int sync_reap(ioengine *e, unsigned min, io_event *ev, unsigned max) {
+	sync_priv *p = e->priv;
+	unsigned n = p->ndone < max ? p->ndone : max;
+	(void)min; // everything submitted is already complete
+	memcpy(ev, p->done, n * sizeof(io_event));
+	memmove(p->done, p->done + n, (p->ndone - n) * sizeof(io_event));
+	p->ndone -= n;
+	return (int)n;
+}
+
+static void sync_exit(ioengine *e) {
+	sync_priv *p = e->priv;
+	free(p->reqs);
+	free(p->done);
+	free(p);
+}
+
+static const ioengine_ops sync_ops = {sync_init, sync_register_buffers, sync_queue, sync_submit, sync_reap, sync_exit};
+
+// libaio: kernel native aio over raw syscalls, no libaio required
+
+typedef struct {
+	aio_context_t ctx;
+	struct iocb *iocbs;
+	struct iocb **pending; // queued iocbs waiting for io_submit
+	unsigned *freelist;
+	unsigned nfree;
+	uint64_t *tags;
+	struct io_event *events;
+} aio_priv;
+
+static int aio_init(ioengine *e) {
+	aio_priv *p = calloc(1, sizeof(aio_priv));
+	unsigned i;
+	if (p == NULL)
+		return -1;
+	p->iocbs = calloc(e->depth, sizeof(struct iocb));
+	p->pending = calloc(e->depth, sizeof(struct iocb *));
+	p->freelist = calloc(e->depth, sizeof(unsigned));
+	p->tags = calloc(e->depth, sizeof(uint64_t));
+	p->events = calloc(e->depth, sizeof(struct io_event));
+	if (p->iocbs == NULL || p->pending == NULL || p->freelist == NULL || p->tags == NULL || p->events == NULL)
+		goto fail;
+	if (syscall(__NR_io_setup, e->depth, &p->ctx) != 0)
+		goto fail;
+	for (i = 0; i < e->depth; i++)
+		p->freelist[i] = e->depth - 1 - i;
+	p->nfree = e->depth;
+	e->priv = p;
+	return 0;
+fail:
+	free(p->iocbs);
+	free(p->pending);
+	free(p->freelist);
+	free(p->tags);
+	free(p->events);
+	free(p);
+	return -1;
+}
+
+static int aio_queue(ioengine *e, io_op op, void *buf, uint64_t len, uint64_t offset, uint64_t tag) {
+	aio_priv *p = e->priv;
+	unsigned idx = p->freelist[--p->nfree];
+	struct iocb *cb = &p->iocbs[idx];
+	memset(cb, 0, sizeof(struct iocb));
+	cb->aio_lio_opcode = op == io_op_write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+	cb->aio_fildes = (uint32_t)e->fd;
+	cb->aio_buf = (uint64_t)(uintptr_t)buf;
+	cb->aio_nbytes = len;
+	cb->aio_offset = (int64_t)offset;
+	cb->aio_data = idx;
+	p->tags[idx] = tag;
+	p->pending[e->queued] = cb;
+	return 0;
+}
+
+static int aio_submit(ioengine *e) {
+	aio_priv *p = e->priv;
+	long ret;
+	unsigned done = 0;
+	while (done < e->queued) {
+		ret = syscall(__NR_io_submit, p->ctx, (long)(e->queued - done), p->pending + done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		done += (unsigned)ret;
+	}
+	return (int)done;
+}
+
+static int aio_reap(ioengine *e, unsigned min, io_event *ev, unsigned max) {
+	aio_priv *p = e->priv;
+	long ret, i;
+	if (max > e->depth)
+		max = e->depth;
+	do {
+		ret = syscall(__NR_io_getevents, p->ctx, (long)min, (long)max, p->events, NULL);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+	for (i = 0; i < ret; i++) {
+		ev[i].tag = p->tags[p->events[i].data];
+		ev[i].res = p->events[i].res;
+		p->freelist[p->nfree++] = (unsigned)p->events[i].data;
+	}
+	return (int)ret;
+}
+
+static void aio_exit(ioengine *e) {
+	aio_priv *p = e->priv;
+	syscall(__NR_io_destroy, p->ctx);
+	free(p->iocbs);
+	free(p->pending);
+	free(p->freelist);
+	free(p->tags);
+	free(p->events);
+	free(p);
+}
+
+static const ioengine_ops aio_ops = {aio_init, sync_register_buffers, aio_queue, aio_submit, aio_reap, aio_exit};
+
+// io_uring: target is registered as fixed file, buffers optionally as fixed buffers
+
+typedef struct {
+	uring_t ring;
+	struct iovec *bufs;
+	unsigned nbufs;
+} uring_priv;
+
+static int uring_engine_init(ioengine *e) {
+	uring_priv *p = calloc(1, sizeof(uring_priv));
+	unsigned flags = 0;
+	if (p == NULL)
+		return -1;
+	if (e->flags & IOENGINE_HIPRI)
+		flags |= IORING_SETUP_IOPOLL;
+	if (e->flags & IOENGINE_SQPOLL)
+		flags |= IORING_SETUP_SQPOLL;
+	if (uring_init(&p->ring, e->depth, flags) != 0) {
+		free(p);
+		return -1;
+	}
+	if (uring_register_files(&p->ring, &e->fd, 1) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "register file failed");
+		uring_exit(&p->ring);
+		free(p);
+		return -1;
+	}
+	e->priv = p;
+	return 0;
+}
+
+static int uring_engine_register_buffers(ioengine *e, struct iovec *iov, unsigned nr) {
+	uring_priv *p = e->priv;
+	if (uring_register_buffers(&p->ring, iov, nr) != 0)
+		return -1;
+	p->bufs = malloc(nr * sizeof(struct iovec));
+	if (p->bufs == NULL)
+		return -1;
+	memcpy(p->bufs, iov, nr * sizeof(struct iovec));
+	p->nbufs = nr;
+	return 0;
+}
+
+static int uring_engine_queue(ioengine *e, io_op op, void *buf, uint64_t len, uint64_t offset, uint64_t tag) {
+	uring_priv *p = e->priv;
+	struct io_uring_sqe *sqe = uring_get_sqe(&p->ring);
+	unsigned i;
+	int opcode = op == io_op_write ? IORING_OP_WRITE : IORING_OP_READ;
+
+	if (sqe == NULL)
+		return -1;
+	for (i = 0; i < p->nbufs; i++) {
+		if ((char *)buf >= (char *)p->bufs[i].iov_base && (char *)buf + len <= (char *)p->bufs[i].iov_base + p->bufs[i].iov_len) {
+			opcode = op == io_op_write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+			sqe->buf_index = (uint16_t)i;
+			break;
+		}
+	}
+	uring_prep_rw(sqe, opcode, 0, buf, (unsigned)len, offset, tag);
+	sqe->flags |= IOSQE_FIXED_FILE;
+	return 0;
+}
+
+static int uring_engine_submit(ioengine *e) {
+	uring_priv *p = e->priv;
+	return uring_submit_and_wait(&p->ring, 0);
+}
+
+static int uring_engine_reap(ioengine *e, unsigned min, io_event *ev, unsigned max) {
+	uring_priv *p = e->priv;
+	struct io_uring_cqe *cqe;
+	unsigned n = 0;
+	int polled = 0;
+	while (n < max) {
+		cqe = uring_peek_cqe(&p->ring);
+		if (cqe == NULL) {
+			// polled rings complete nothing on their own, look once even if nothing is required
+			if (n >= min && (polled || !(e->flags & IOENGINE_HIPRI) || (e->flags & IOENGINE_SQPOLL)))
+				break;
+			polled = 1;
+			if (uring_submit_and_wait(&p->ring, min > n ? min - n : 0) < 0)
+				return -1;
+			continue;
+		}
+		ev[n].tag = cqe->user_data;
+		ev[n].res = cqe->res;
+		uring_cqe_seen(&p->ring);
+		n++;
+	}
+	return (int)n;
+}
+
+static void uring_engine_exit(ioengine *e) {
+	uring_priv *p = e->priv;
+	uring_exit(&p->ring);
+	free(p->bufs);
+	free(p);
+}
+
+static const ioengine_ops uring_ops = {uring_engine_init, uring_engine_register_buffers, uring_engine_queue, uring_engine_submit,
+									   uring_engine_reap, uring_engine_exit};
+
+int ioengine_parse(const char *name, ioengine_type *type) {
+	if (strcmp("sync", name) == 0)
+		*type = ioengine_sync;
+	else if (strcmp("psync", name) == 0)
+		*type = ioengine_psync;
+	else if (strcmp("libaio", name) == 0)
+		*type = ioengine_libaio;
+	else if (strcmp("io_uring", name) == 0)
+		*type = ioengine_uring;
+	else
+		return -1;
+	return 0;
+}
+
+const char *ioengine_name(ioengine_type type) {
+	switch (type) {
+		case ioengine_sync:
+			return "sync";
+		case ioengine_psync:
+			return "psync";
+		case ioengine_libaio:
+			return "libaio";
+		case ioengine_uring:
+			return "io_uring";
+		default:
+			return "undefined";
+	}
+}
+
+static io_devstat *devstats = NULL;
+static int ndevstats = 0;
+static unsigned engineflags = 0;
+
+// IOENGINE_* applied to every engine initialized afterwards
+void ioengine_set_flags(unsigned flags) { engineflags = flags; }
+
+unsigned ioengine_get_flags(void) { return engineflags; }
+
+// engines initialized afterwards on one of these devices add their completed bytes to its entry
+void ioengine_set_devstats(io_devstat *stats, int n) {
+	devstats = stats;
+	ndevstats = n;
+}
+
+// queue/io_poll of the block device behind fd (partitions use their disk's), -1 if unknown
+static int ioengine_can_poll(int fd) {
+	struct stat st;
+	char path[64];
+	FILE *fp;
+	int v;
+
+	if (fstat(fd, &st) != 0 || !S_ISBLK(st.st_mode))
+		return -1;
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/io_poll", major(st.st_rdev), minor(st.st_rdev));
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/io_poll", major(st.st_rdev), minor(st.st_rdev));
+		fp = fopen(path, "r");
+	}
+	if (fp == NULL)
+		return -1;
+	if (fscanf(fp, "%d", &v) != 1)
+		v = -1;
+	fclose(fp);
+	return v;
+}
+
+int ioengine_init(ioengine *e, ioengine_type type, int fd, unsigned depth) {
+	struct stat st;
+	int i;
+
+	memset(e, 0, sizeof(ioengine));
+	e->type = type;
+	e->fd = fd;
+	e->depth = depth;
+	e->flags = engineflags;
+	if (ndevstats > 0 && fstat(fd, &st) == 0) {
+		for (i = 0; i < ndevstats; i++)
+			if (devstats[i].rdev == st.st_rdev)
+				e->devstat = &devstats[i];
+	}
+	switch (type) {
+		case ioengine_sync:
+		case ioengine_psync:
+			e->ops = &sync_ops;
+			break;
+		case ioengine_libaio:
+			e->ops = &aio_ops;
+			break;
+		case ioengine_uring:
+			e->ops = &uring_ops;
+			break;
+		default:
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "undefined ioengine");
+			return -1;
+	}
+	if (depth < 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "wrong iodepth");
+		return -1;
+	}
+	if ((e->flags & IOENGINE_HIPRI) && type == ioengine_libaio) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "libaio can't poll for completions, use io_uring or psync with --hipri");
+		return -1;
+	}
+	if ((e->flags & IOENGINE_HIPRI) && ioengine_can_poll(fd) == 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "device has no poll queues (queue/io_poll is 0, nvme needs poll_queues > 0)");
+		return -1;
+	}
+	if ((e->flags & IOENGINE_SQPOLL) && type != ioengine_uring) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sqpoll is only for io_uring");
+		return -1;
+	}
+	e->slots = calloc(depth, sizeof(io_slot));
+	e->freeslots = calloc(depth, sizeof(unsigned));
+	e->pending = calloc(depth, sizeof(unsigned));
+	if (e->slots == NULL || e->freeslots == NULL || e->pending == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "calloc for slots failed");
+		return -1;
+	}
+	for (e->nfree = 0; e->nfree < depth; e->nfree++)
+		e->freeslots[e->nfree] = depth - 1 - e->nfree;
+	if (e->ops->init(e) != 0) {
+		printf("%s:%d %s(): %s %s\n", __FILE__, __LINE__, __func__, ioengine_name(type), "init failed");
+		return -1;
+	}
+	e->trace = trace_attach();
+	e->metrics = metrics_attach(fd);
+	return 0;
+}
+
+int ioengine_register_buffers(ioengine *e, struct iovec *iov, unsigned nr) { return e->ops->register_buffers(e, iov, nr); }
+
+// returns -1 when depth requests are already queued or in flight
+int ioengine_queue(ioengine *e, io_op op, void *buf, uint64_t len, uint64_t offset, uint64_t tag) {
+	unsigned slot;
+	if (e->queued + e->inflight >= e->depth)
+		return -1;
+	slot = e->freeslots[e->nfree - 1];
+	if (e->ops->queue(e, op, buf, len, offset, slot) != 0)
+		return -1;
+	e->nfree--;
+	e->slots[slot].tag = tag;
+	e->slots[slot].op = op;
+	e->slots[slot].offset = offset;
+	e->slots[slot].len = len;
+	e->slots[slot].intended_ns = 0;
+	e->pending[e->queued] = slot;
+	e->queued++;
+	return 0;
+}
+
+// for open-loop load, response time is counted from intended_ns (getNowNS() clock) even if the request
+// could only be queued later
+int ioengine_queue_at(ioengine *e, io_op op, void *buf, uint64_t len, uint64_t offset, uint64_t tag, uint64_t intended_ns) {
+	if (ioengine_queue(e, op, buf, len, offset, tag) != 0)
+		return -1;
+	e->slots[e->pending[e->queued - 1]].intended_ns = intended_ns;
+	return 0;
+}
+
+int ioengine_submit(ioengine *e) {
+	int ret;
+	unsigned i;
+	uint64_t now;
+	if (e->queued == 0)
+		return 0;
+	now = getNowNS();
+	for (i = 0; i < e->queued; i++)
+		e->slots[e->pending[i]].start_ns = now;
+	ret = e->ops->submit(e);
+	if (ret < 0)
+		return -1;
+	e->inflight += e->queued;
+	e->queued = 0;
+	return ret;
+}
+
+// ev[].lat_ns is the time from submit to reap of each request, ev[].resp_ns from the intended start
+int ioengine_reap(ioengine *e, unsigned min, io_event *ev, unsigned max) {
+	int ret, i;
+	unsigned slot;
+	uint64_t now;
+	if (min > e->inflight)
+		min = e->inflight;
+	ret = e->ops->reap(e, min, ev, max);
+	if (ret < 0)
+		return -1;
+	now = getNowNS();
+	for (i = 0; i < ret; i++) {
+		slot = (unsigned)ev[i].tag;
+		ev[i].tag = e->slots[slot].tag;
+		ev[i].lat_ns = now - e->slots[slot].start_ns;
+		ev[i].resp_ns = e->slots[slot].intended_ns != 0 ? now - e->slots[slot].intended_ns : ev[i].lat_ns;
+		if (e->devstat != NULL && ev[i].res > 0)
+			atomic_fetch_add_explicit(e->slots[slot].op == io_op_read ? &e->devstat->bytes_r : &e->devstat->bytes_w,
+									  (uint64_t)ev[i].res, memory_order_relaxed);
+		if (e->trace != NULL)
+			trace_push(e->trace, now, e->slots[slot].offset, (uint32_t)e->slots[slot].len, (uint8_t)e->slots[slot].op, ev[i].res,
+					   ev[i].lat_ns);
+		if (e->metrics != NULL)
+			metrics_count(e->metrics, e->slots[slot].op, ev[i].res, ev[i].lat_ns);
+		e->freeslots[e->nfree++] = slot;
+	}
+	e->inflight -= (unsigned)ret;
+	return ret;
+}
+
+void ioengine_exit(ioengine *e) {
+	trace_detach(e->trace);
+	metrics_detach(e->metrics);
+	e->ops->exit(e);
+	free(e->slots);
+	free(e->freeslots);
+	free(e->pending);
+}
+
+// sequentially transfer len bytes between buf and [offset, offset + len) in blocksize requests,
+// keeping up to depth of them in flight. progress (if given) is increased on each completion
+// and every request's latency is recorded into hist (if given)
+int ioengine_transfer(ioengine *e, io_op op, void *buf, uint64_t len, uint64_t offset, uint64_t blocksize, uint64_t *progress,
+					  histogram *hist) {
+	io_event ev[64];
+	uint64_t issued, done, n;
+	int i, ret;
+
+	issued = 0;
+	done = 0;
+	while (done < len) {
+		while (issued < len) {
+			n = len - issued < blocksize ? len - issued : blocksize;
+			if (ioengine_queue(e, op, (char *)buf + issued, n, offset + issued, n) != 0)
+				break;
+			issued += n;
+		}
+		if (ioengine_submit(e) < 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "submit failed");
+			return -1;
+		}
+		ret = ioengine_reap(e, 1, ev, 64);
+		if (ret < 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "reap failed");
+			return -1;
+		}
+		for (i = 0; i < ret; i++) {
+			if (ev[i].res != (int64_t)ev[i].tag) {
+				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, op == io_op_write ? "write error" : "read error");
+				return -1;
+			}
+			done += (uint64_t)ev[i].res;
+			if (progress != NULL)
+				atomic_fetch_add(progress, (uint64_t)ev[i].res);
+			if (hist != NULL)
+				hist_record(hist, ev[i].lat_ns);
+		}
+	}
+	return 0;
+}
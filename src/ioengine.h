@@ -0,0 +1,92 @@
+#pragma once
+
+#include "histogram.h"
+#include "metrics.h"
+#include "trace.h"
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef enum { //
+	ioengine_sync,
+	ioengine_psync,
+	ioengine_libaio,
+	ioengine_uring,
+	ioengine_undefined
+} ioengine_type;
+
+typedef enum { //
+	io_op_read,
+	io_op_write
+} io_op;
+
+typedef struct {
+	uint64_t tag; // caller's cookie given to ioengine_queue()
+	int64_t res;  // transferred bytes or -errno
+	uint64_t lat_ns;
+	uint64_t resp_ns; // from the intended start given to ioengine_queue_at(), lat_ns otherwise
+} io_event;
+
+typedef struct {
+	uint64_t tag;
+	io_op op;
+	uint64_t offset;
+	uint64_t len;
+	uint64_t start_ns;
+	uint64_t intended_ns; // 0: same as start_ns
+} io_slot;
+
+// bytes moved on one block device by every engine opened on it, summed over all threads
+typedef struct {
+	dev_t rdev;
+	_Alignas(64) uint64_t bytes_r;
+	uint64_t bytes_w;
+} io_devstat;
+
+// ioengine_set_flags()
+#define IOENGINE_HIPRI 0x1	// poll for completions: io_uring IOPOLL, RWF_HIPRI for sync/psync
+#define IOENGINE_SQPOLL 0x2 // io_uring submission by a kernel thread
+
+typedef struct ioengine ioengine;
+
+typedef struct {
+	int (*init)(ioengine *e);
+	int (*register_buffers)(ioengine *e, struct iovec *iov, unsigned nr);
+	int (*queue)(ioengine *e, io_op op, void *buf, uint64_t len, uint64_t offset, uint64_t tag);
+	int (*submit)(ioengine *e);
+	int (*reap)(ioengine *e, unsigned min, io_event *ev, unsigned max);
+	void (*exit)(ioengine *e);
+} ioengine_ops;
+
+struct ioengine {
+	ioengine_type type;
+	const ioengine_ops *ops;
+	int fd;
+	unsigned depth;
+	unsigned flags;	   // IOENGINE_*
+	unsigned queued;   // queued but not submitted yet
+	unsigned inflight; // submitted but not reaped yet
+	io_slot *slots;    // per request tag and submit time, indexed by the tag given to the backend
+	unsigned *freeslots;
+	unsigned nfree;
+	unsigned *pending; // slots queued since last submit
+	io_devstat *devstat; // NULL unless the device was registered with ioengine_set_devstats()
+	trace_ring *trace;	 // NULL unless --trace
+	metrics_engine *metrics; // NULL unless metrics are published
+	void *priv;
+};
+
+int ioengine_parse(const char *name, ioengine_type *type);
+const char *ioengine_name(ioengine_type type);
+void ioengine_set_devstats(io_devstat *stats, int n);
+void ioengine_set_flags(unsigned flags);
+unsigned ioengine_get_flags(void);
+int ioengine_init(ioengine *e, ioengine_type type, int fd, unsigned depth);
+int ioengine_register_buffers(ioengine *e, struct iovec *iov, unsigned nr);
+int ioengine_queue(ioengine *e, io_op op, void *buf, uint64_t len, uint64_t offset, uint64_t tag);
+int ioengine_queue_at(ioengine *e, io_op op, void *buf, uint64_t len, uint64_t offset, uint64_t tag, uint64_t intended_ns);
+int ioengine_submit(ioengine *e);
+int ioengine_reap(ioengine *e, unsigned min, io_event *ev, unsigned max);
+void ioengine_exit(ioengine *e);
+int ioengine_transfer(ioengine *e, io_op op, void *buf, uint64_t len, uint64_t offset, uint64_t blocksize, uint64_t *progress,
+					 histogram *hist);
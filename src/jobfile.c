@@ -0,0 +1,355 @@
+#define _GNU_SOURCE
+#include "jobfile.h"
+#include "drive.h"
+#include "iobuf.h"
+#include "rng.h"
+#include "tools.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// job file, ini style:
+//
+//   [global]          ; defaults for the sections below it
+//   ioengine=io_uring
+//   runtime=60
+//   [oltp]
+//   rw=randrw         ; read|write|rw (sequential) or randread|randwrite|randrw
+//   rwmixread=70
+//   bs=4k/60,16k/30,128k/10
+//   iodepth=16
+//   numjobs=2
+//   offset=0
+//   size=50%
+//   random_distribution=zipf:1.2
+//   rate_iops=20k     ; open loop, k/m are x1000 here, also rate_bw=200m (bytes/s, x1024)
+//
+// sections other than global run one after another
+
+void init_jobfile_params(jobfile_params *p, char *drv, char *jobfilepath) {
+	p->targetdrv = drv;
+	p->jobfilepath = jobfilepath;
+}
+
+static char *Trim(char *str) {
+	char *end;
+	while (isspace((unsigned char)*str))
+		str++;
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		end--;
+	*end = '\0';
+	return str;
+}
+
+// "12345", "1g" or "25%"
+static int ParseBytesOrPct(const char *str, uint64_t *v, int *pct) {
+	char *endptr;
+	if (parseBytes(str, v, &endptr) != 0)
+		return -1;
+	if (*endptr == '%' && endptr[1] == '\0' && *v <= 100) {
+		*pct = (int)*v;
+		return 0;
+	}
+	*pct = -1;
+	return *endptr == '\0' ? 0 : -1;
+}
+
+// "4k" or weighted "4k/60,16k/30,128k/10"
+static int ParseBlockSizes(const char *str, jobfile_job *job) {
+	char *endptr;
+	uint64_t size;
+	int n = 0, max = 0;
+	while (1) {
+		if (n == SUSR_MAX_BS || parseBytes(str, &size, &endptr) != 0 || size == 0 || size > 0x7fffffff)
+			return -1;
+		job->params.bs[n] = (int)size;
+		job->bsweight[n] = 1;
+		if (*endptr == '/') {
+			job->bsweight[n] = strtod(endptr + 1, &endptr);
+			if (job->bsweight[n] < 0)
+				return -1;
+		}
+		if ((int)size > max)
+			max = (int)size;
+		n++;
+		if (*endptr == '\0')
+			break;
+		if (*endptr != ',')
+			return -1;
+		str = endptr + 1;
+	}
+	job->params.nbs = n;
+	job->params.iosize = max;
+	return 0;
+}
+
+static int SetJobKey(jobfile_job *job, const char *key, const char *val) {
+	char *endptr;
+	uint64_t sec;
+	long v;
+
+	if (strcmp(key, "rw") == 0) {
+		job->params.sequential = strncmp(val, "rand", 4) != 0;
+		if (!job->params.sequential)
+			val += 4;
+		if (strcmp(val, "read") == 0)
+			job->params.rwmode = susr_rwmode_r;
+		else if (strcmp(val, "write") == 0)
+			job->params.rwmode = susr_rwmode_w;
+		else if (strcmp(val, "rw") == 0)
+			job->params.rwmode = susr_rwmode_rw;
+		else
+			return -1;
+	} else if (strcmp(key, "rwmixread") == 0) {
+		v = strtol(val, &endptr, 10);
+		if (*val == '\0' || *endptr != '\0' || v < 0 || v > 100)
+			return -1;
+		job->rwmixread = (int)v;
+	} else if (strcmp(key, "bs") == 0) {
+		return ParseBlockSizes(val, job);
+	} else if (strcmp(key, "iodepth") == 0) {
+		v = strtol(val, &endptr, 10);
+		if (*val == '\0' || *endptr != '\0' || v < 1 || v > 4096)
+			return -1;
+		job->params.iodepth = (int)v;
+	} else if (strcmp(key, "numjobs") == 0) {
+		v = strtol(val, &endptr, 10);
+		if (*val == '\0' || *endptr != '\0' || v < 1 || v > 256)
+			return -1;
+		job->params.numjobs = (int)v;
+	} else if (strcmp(key, "runtime") == 0) {
+		if (parseDurationSec(val, &sec) != 0 || sec == 0 || sec > 0x7fffffff)
+			return -1;
+		job->params.durationsec = (int)sec;
+	} else if (strcmp(key, "ioengine") == 0) {
+		return ioengine_parse(val, &job->params.ioengine);
+	} else if (strcmp(key, "random_distribution") == 0) {
+		return dist_parse(val, &job->params.dist);
+	} else if (strcmp(key, "rate_iops") == 0) {
+		if (parseCount(val, &job->params.rate_iops, &endptr) != 0 || *endptr != '\0')
+			return -1;
+	} else if (strcmp(key, "rate_bw") == 0) {
+		if (parseBytes(val, &job->params.rate_bw, &endptr) != 0 || *endptr != '\0')
+			return -1;
+	} else if (strcmp(key, "offset") == 0) {
+		return ParseBytesOrPct(val, &job->offset, &job->offsetpct);
+	} else if (strcmp(key, "size") == 0) {
+		return ParseBytesOrPct(val, &job->size, &job->sizepct);
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+// returns number of jobs or -1
+int LoadJobFile(const char *path, char *targetdrv, jobfile_job *jobs, int maxjobs) {
+	FILE *f;
+	char line[1024], *p, *eq, *end;
+	int lineno, njobs, i;
+	jobfile_job global, *cur;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fopen job file failed");
+		return -1;
+	}
+	memset(&global, 0, sizeof(jobfile_job));
+	init_susrandom_params(&global.params, targetdrv, susr_rwmode_r, 4096, 10, ioengine_undefined, 1, 1, NULL);
+	global.offsetpct = -1;
+	global.sizepct = -1;
+	global.rwmixread = -1;
+	cur = NULL;
+	njobs = 0;
+	lineno = 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		p = strpbrk(line, "#;");
+		if (p != NULL)
+			*p = '\0';
+		p = Trim(line);
+		if (*p == '\0')
+			continue;
+		if (*p == '[') {
+			end = strchr(p, ']');
+			if (end == NULL || end[1] != '\0' || end - p - 1 < 1 || end - p - 1 >= (long)sizeof(global.name)) {
+				printf("%s:%d %s(): line %d: %s\n", __FILE__, __LINE__, __func__, lineno, "bad section name");
+				fclose(f);
+				return -1;
+			}
+			*end = '\0';
+			if (strcmp(p + 1, "global") == 0) {
+				cur = &global;
+			} else {
+				if (njobs == maxjobs) {
+					printf("%s:%d %s(): line %d: %s\n", __FILE__, __LINE__, __func__, lineno, "too many jobs");
+					fclose(f);
+					return -1;
+				}
+				cur = &jobs[njobs++];
+				memcpy(cur, &global, sizeof(jobfile_job));
+				strcpy(cur->name, p + 1);
+			}
+			continue;
+		}
+		eq = strchr(p, '=');
+		if (cur == NULL || eq == NULL) {
+			printf("%s:%d %s(): line %d: %s\n", __FILE__, __LINE__, __func__, lineno, "expected [section] or key=value");
+			fclose(f);
+			return -1;
+		}
+		*eq = '\0';
+		if (SetJobKey(cur, Trim(p), Trim(eq + 1)) != 0) {
+			printf("%s:%d %s(): line %d: %s\n", __FILE__, __LINE__, __func__, lineno, "unknown key or bad value");
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	if (njobs == 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "no job in job file");
+		return -1;
+	}
+	// read share once every key is known, key order within a section doesn't matter
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].params.rwmode == susr_rwmode_rw) {
+			jobs[i].params.readpct = jobs[i].rwmixread >= 0 ? jobs[i].rwmixread : 50;
+		} else if (jobs[i].rwmixread >= 0) {
+			printf("%s:%d %s(): [%s] %s\n", __FILE__, __LINE__, __func__, jobs[i].name, "rwmixread is only for rw=rw or rw=randrw");
+			return -1;
+		} else {
+			jobs[i].params.readpct = jobs[i].params.rwmode == susr_rwmode_r ? 100 : 0;
+		}
+	}
+	return njobs;
+}
+
+int RunJobFile(jobfile_params *params) {
+	int fd, njobs, i, j;
+	uint64_t *wbuf, *rbuf;
+	uint64_t t, physicalsectorsize, bufsize;
+	jobfile_job *jobs, *job;
+	susrandom_params *p;
+	susrandom_result res;
+	char distname[256];
+	int buf_MB = 256;
+
+	t = 0;
+	physicalsectorsize = 0;
+
+	jobs = calloc(JOBFILE_MAX_JOBS, sizeof(jobfile_job));
+	if (jobs == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "calloc for jobs failed");
+		return -1;
+	}
+	njobs = LoadJobFile(params->jobfilepath, params->targetdrv, jobs, JOBFILE_MAX_JOBS);
+	if (njobs < 0)
+		return -1;
+
+	if (CheckIfBlockDevice(params->targetdrv) != 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "target is not a block device");
+		return -1;
+	}
+	if (getDriveSize(params->targetdrv, &t) != 0 || t < 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "getDriveSize failed");
+		return -1;
+	}
+	if (getPhysicalSectorSize(params->targetdrv, &physicalsectorsize) != 0 || physicalsectorsize < 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "getPhysicalSectorSize failed");
+		return -1;
+	}
+
+	// resolve and check every job before the first one runs
+	for (i = 0; i < njobs; i++) {
+		job = &jobs[i];
+		p = &job->params;
+		if (job->offsetpct >= 0)
+			job->offset = t / 100 * job->offsetpct;
+		if (job->sizepct >= 0)
+			job->size = t / 100 * job->sizepct;
+		p->rangestart = job->offset / physicalsectorsize * physicalsectorsize;
+		p->rangelen = job->size / physicalsectorsize * physicalsectorsize;
+		if (p->rangestart >= t || p->rangestart + p->rangelen > t) {
+			printf("%s:%d %s(): [%s] %s\n", __FILE__, __LINE__, __func__, job->name, "offset/size is out of the device");
+			return -1;
+		}
+		for (j = 0; j < p->nbs; j++) {
+			if ((uint64_t)p->bs[j] % physicalsectorsize != 0) {
+				printf("%s:%d %s(): [%s] %s\n", __FILE__, __LINE__, __func__, job->name, "bs is not a multiple of physical sector size");
+				return -1;
+			}
+		}
+		if (p->ioengine == ioengine_undefined)
+			p->ioengine = p->iodepth > 1 ? ioengine_uring : ioengine_psync;
+		if ((p->ioengine == ioengine_sync || p->ioengine == ioengine_psync) && p->iodepth > 1) {
+			printf("%s:%d %s(): [%s] %s\n", __FILE__, __LINE__, __func__, job->name, "sync and psync engines support only iodepth 1");
+			return -1;
+		}
+		// workers share the fd, sync engine would race on its offset
+		if (p->ioengine == ioengine_sync && p->numjobs > 1) {
+			printf("%s:%d %s(): [%s] %s\n", __FILE__, __LINE__, __func__, job->name, "sync engine supports only numjobs 1");
+			return -1;
+		}
+		if (p->nbs > 1 && alias_init(&p->bsalias, job->bsweight, (uint32_t)p->nbs) != 0) {
+			printf("%s:%d %s(): [%s] %s\n", __FILE__, __LINE__, __func__, job->name, "bad bs weights");
+			return -1;
+		}
+	}
+
+	// open target once, prepare buffers once
+	fd = open(params->targetdrv, O_RDWR | O_DIRECT);
+	if (fd == -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "open target failed");
+		return -1;
+	}
+	bufsize = (uint64_t)1024 * 1024 * buf_MB;
+	wbuf = iobuf_alloc(params->targetdrv, bufsize);
+	rbuf = iobuf_alloc(params->targetdrv, bufsize);
+	if (wbuf == NULL || rbuf == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for buffers failed");
+		return -1;
+	}
+	pcg32_fill(wbuf, bufsize, ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid());
+	memset(rbuf, '\0', bufsize);
+
+	// fire!
+	for (i = 0; i < njobs; i++) {
+		job = &jobs[i];
+		p = &job->params;
+		printf("[%s] %s, read %d %%, bs", job->name, p->sequential ? "sequential" : "random", p->readpct);
+		for (j = 0; j < p->nbs; j++)
+			printf("%s%d/%g", j == 0 ? " " : ",", p->bs[j], p->nbs > 1 ? job->bsweight[j] : 100.0);
+		dist_name(&p->dist, distname, sizeof(distname));
+		printf(", range %" PRIu64 "+%" PRIu64 ", %s, %s, iodepth %d, numjobs %d, %d s\n", p->rangestart,
+			   p->rangelen != 0 ? p->rangelen : t - p->rangestart, p->sequential ? "-" : distname, ioengine_name(p->ioengine), p->iodepth,
+			   p->numjobs, p->durationsec);
+		if (RandomRun(p, fd, t, wbuf, rbuf, bufsize, &res) != 0) {
+			printf("%s:%d %s(): [%s] %s\n", __FILE__, __LINE__, __func__, job->name, "RandomRun failed");
+			return -1;
+		}
+		printf("Total IOs(R) : %" PRIu64 "\n", res.numios_r);
+		printf("Total IOs(W) : %" PRIu64 "\n", res.numios_w);
+		printf("IOPS         : %" PRIu64 "\n", (res.numios_r + res.numios_w) * 1000 / res.elapsed_ms);
+		printf("Throughput   : %.2f MB/s\n", (double)res.bytes / res.elapsed_ms / 1000);
+		PrintRateResult(p, &res);
+		PrintCPUResult(&res);
+		hist_print(&res.hist, "Latency");
+		if (p->nbs > 1)
+			alias_free(&p->bsalias);
+	}
+
+	// finalize
+	free(jobs);
+	iobuf_free(wbuf, bufsize);
+	iobuf_free(rbuf, bufsize);
+	if (close(fd) == -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "close target failed");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "sus_random.h"
+
+#define JOBFILE_MAX_JOBS 32
+
+// one [section] of the job file, offset/size may be a percentage of the device
+typedef struct {
+	char name[64];
+	susrandom_params params;
+	double bsweight[SUSR_MAX_BS];
+	uint64_t offset;
+	int offsetpct; // -1: offset is in bytes
+	uint64_t size; // 0: up to the end of device
+	int sizepct;   // -1: size is in bytes
+	int rwmixread; // -1: not given, readpct follows rw
+} jobfile_job;
+
+typedef struct {
+	char *targetdrv;
+	char *jobfilepath;
+} jobfile_params;
+
+void init_jobfile_params(jobfile_params *params, char *targetdrv, char *jobfilepath);
+int LoadJobFile(const char *path, char *targetdrv, jobfile_job *jobs, int maxjobs);
+int RunJobFile(jobfile_params *params);
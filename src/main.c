@@ -1,30 +1,97 @@
 #define _GNU_SOURCE
 #include "main.h"
+#include "affinity.h"
+#include "metrics.h"
+#include "analyze.h"
+#include "ioengine.h"
+#include "drivetemp.h"
+#include "jobfile.h"
+#include "multi.h"
 #include "refresh.h"
+#include "replay.h"
 #include "seq.h"
 #include "sus_random.h"
+#include "sweep.h"
+#include "tools.h"
+#include "trace.h"
 #include "verify.h"
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 //#include <pthread.h>
 //#include <sched.h>
 
 void PrintUsage(void) {
 	puts("usage:");
-	puts("diskexp --verify device");
-	puts("diskexp --susrandom {r|w|rw} [-b 4096] [-t 300] [-o log.txt] device");
+	puts("diskexp --verify [--pattern lba] [--seed 1234] [--generation 2] [--readonly] [--ioengine libaio] [--iodepth 4] device");
+	puts("    where  --pattern {random|lba|stamp} (default random, lba: regenerated per sector from seed and LBA,");
+	puts("                     stamp: lba pattern with a header of LBA, run id, generation, time and crc32c in every sector,");
+	puts("                     failures are classified as unwritten, corrupt, torn, misdirected, stale or foreign)");
+	puts("           --seed lba_pattern_seed or stamp run id (default random, printed at start)");
+	puts("           --generation stamp pass number written or expected (default 1, any with --readonly)");
+	puts("           --readonly skip writing, check a disk written before with --pattern lba|stamp --seed");
+	puts("diskexp --susrandom {r|w|rw} [-b 4096] [-t 300] [--ioengine io_uring] [--iodepth 32] [--numjobs 4] [--rate-iops 20000] [--random-distribution zipf:1.2] [-o log.txt] device");
 	puts("    where  --susrandom rwmode");
 	puts("           -b blocksize_in_byte (default 4096)");
 	puts("           -t duration_in_sec (default 10)");
+	puts("           --numjobs number_of_worker_threads (default 1)");
+	puts("           --rate-iops N (k/m: x1000), --rate-bw bytes_per_sec (k/m/g: x1024) open loop: IOs start on a fixed");
+	puts("                          schedule, response time is measured from the scheduled start so stalls are not hidden");
+	puts("           --random-distribution {uniform|zipf:theta|pareto:h|zoned:access%/size%:...} (default uniform)");
+	puts("                                 e.g. zipf:1.2, pareto:0.2, zoned:60/10:30/20:10/70 (also for --sweep)");
 	puts("           -o logfile");
-	puts("diskexp --seq {r|w} [--calcsize 500] [-o log.txt] [--tempmonitor 30] device");
+	puts("diskexp --seq {r|w} [-b 1048576] [--streams 4] [--samples 200 [--sample-random]] [--calcsize 500] [-o log.txt] [--tempmonitor 30] [--ioengine libaio] [--iodepth 4] device");
 	puts("    where  --seq rwmode");
+	puts("           -b blocksize_in_byte (default 1048576)");
+	puts("           --streams split device into N ranges accessed concurrently (default 1)");
+	puts("           --samples access only N calcsize windows evenly spaced over the device, for a quick curve");
+	puts("           --sample-random pick the --samples windows at random instead");
 	puts("           --calcsize calc_every_MiB (default 500)");
 	puts("           -o logfile");
-	puts("           --tempmonitor interval_in_sec");
-	puts("diskexp --refresh [--safe] device");
+	puts("           --tempmonitor interval_in_sec, read from hwmon sysfs, nvme smart log or ata smart (smartctl as last resort)");
+	puts("                         " DRIVETEMP_SYSFS_ENV " environment variable replaces /sys");
+	puts("diskexp --refresh [--safe] [--statefile refresh.state] [--older-than 90d] [--ioengine libaio] [--iodepth 4] device");
+	puts("    where  --statefile path, remembers refreshed regions so an interrupted run resumes");
+	puts("           --older-than age, rewrite only regions last refreshed before age ago (s|m|h|d suffix, needs --statefile)");
+	puts("diskexp --sweep [--sweep-bs 4096,65536] [--sweep-qd 1,8,32] [--sweep-mix 100,70,0] [-t 5] [--numjobs 1] [-o table.tsv] device");
+	puts("    where  --sweep-bs block sizes in byte (default 4096,16384,65536,131072,1048576)");
+	puts("           --sweep-qd iodepths (default 1,2,4,8,16,32,64)");
+	puts("           --sweep-mix read percentages of random access (default 100, read only, e.g. 100,70,0 adds writes that");
+	puts("                       destroy the data on the device)");
+	puts("           -t duration_in_sec of each cell (default 5)");
+	puts("           -o table as tab separated values");
+	puts("diskexp --jobfile jobs.ini device");
+	puts("    where  --jobfile ini file with [sections] of rw, rwmixread, bs (4k/60,16k/40), iodepth, numjobs, runtime, ioengine,");
+	puts("                    offset and size (bytes or %), [global] gives defaults, sections run one after another");
+	puts("diskexp --replay trace [--replay-speed 1] [--iodepth 32] [-o per_io.tsv] device");
+	puts("    where  --replay blkparse text output or a --trace file, IOs are issued at their original times");
+	puts("           --replay-speed factor on the original timing, 2 twice as fast, 0 as fast as possible (default 1)");
+	puts("           --iodepth most IOs in flight (default 32)");
+	puts("           -o original and replayed latency of every IO as tab separated values");
+	puts("diskexp --analyze trace.bin [-o series.tsv]");
+	puts("    where  --analyze prints latency histograms, a time series and an lba heatmap of a --trace file");
+	puts("           -o full per second series as tab separated values");
+	puts("diskexp <mode and options as above> device [device ...]");
+	puts("    where  every device runs the mode concurrently in its own threads, the terminal shows a combined progress");
+	puts("           line and a per device bandwidth table, the modes' own output goes to " MULTI_LOGFILE);
+	puts("           -o and --statefile paths get .<device name> appended");
+	puts("           --pin pin the threads of each device to one cpu");
+	puts("common options");
+	puts("           --ioengine {sync|psync|libaio|io_uring} (default sync, psync for --susrandom)");
+	puts("           --iodepth requests_in_flight (default 1, io_uring is selected if > 1 and no --ioengine)");
+	puts("           --trace file, record every IO (time, lba, size, op, latency, result) for --analyze, one device only");
+	puts("           --metrics-socket path, serve live counters every 100ms on a unix socket, prometheus text or json if the");
+	puts("                            request contains \"json\" (curl --unix-socket path http://localhost/json)");
+	puts("           --metrics-textfile path, rewrite the same prometheus text every second for node-exporter");
+	puts("           --cpus list, e.g. 2-5,8: one cpu per IO thread in blk-mq queue order, helper threads go to a cpu outside");
+	puts("           --numa-node {N|auto}, buffers on node N (auto: the device's node) and IO threads on its cpus if no --cpus");
+	puts("           --hipri poll for completions instead of waiting for the interrupt: io_uring IOPOLL, RWF_HIPRI with sync/psync");
+	puts("                   (kernels since 5.16 poll only for io_uring), the device needs poll queues (nvme poll_queues > 0)");
+	puts("                   cpu usage of the IO threads is reported next to the latency of --susrandom and --jobfile");
+	puts("           --sqpoll io_uring only, a kernel thread submits so IOs are queued without a syscall");
 }
 
 int ParseOption(int argc, char *argv[], op_params *work) {
@@ -36,20 +103,88 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 								{"calcsize", required_argument, NULL, 'c'},
 								{"tempmonitor", required_argument, NULL, 'm'},
 								{"safe", no_argument, NULL, 'x'},
+								{"iodepth", required_argument, NULL, 'q'},
+								{"numjobs", required_argument, NULL, 'j'},
+								{"ioengine", required_argument, NULL, 'e'},
+								{"pattern", required_argument, NULL, 'p'},
+								{"seed", required_argument, NULL, 'S'},
+								{"readonly", no_argument, NULL, 'R'},
+								{"generation", required_argument, NULL, 'g'},
+								{"statefile", required_argument, NULL, 'F'},
+								{"older-than", required_argument, NULL, 'O'},
+								{"streams", required_argument, NULL, 'N'},
+								{"samples", required_argument, NULL, 'K'},
+								{"sample-random", no_argument, NULL, 'Z'},
+								{"jobfile", required_argument, NULL, 'J'},
+								{"random-distribution", required_argument, NULL, 'D'},
+								{"rate-iops", required_argument, NULL, 'I'},
+								{"rate-bw", required_argument, NULL, 'X'},
+								{"sweep", no_argument, NULL, 'W'},
+								{"sweep-bs", required_argument, NULL, 'B'},
+								{"sweep-qd", required_argument, NULL, 'Q'},
+								{"sweep-mix", required_argument, NULL, 'M'},
+								{"pin", no_argument, NULL, 'P'},
+								{"trace", required_argument, NULL, 'T'},
+								{"analyze", required_argument, NULL, 'A'},
+								{"replay", required_argument, NULL, 'L'},
+								{"replay-speed", required_argument, NULL, 'G'},
+								{"metrics-socket", required_argument, NULL, 'U'},
+								{"metrics-textfile", required_argument, NULL, 'H'},
+								{"cpus", required_argument, NULL, 'C'},
+								{"numa-node", required_argument, NULL, 'n'},
+								{"hipri", no_argument, NULL, 'i'},
+								{"sqpoll", no_argument, NULL, 'k'},
 								{0, 0, 0, 0}};
 	int val;
 	int opt_tempmonitorinterval = -1;
 	int opt_blocksize = -1;
 	int opt_calcsize = -1;
 	int opt_duration = -1;
+	int opt_iodepth = -1;
+	int opt_numjobs = -1;
+	int opt_streams = -1;
+	int opt_samples = -1;
+	int opt_samplerandom = 0;
+	int opt_pin = 0;
+	int opt_sweep_bs[SWEEP_MAX_VALUES] = {4096, 16384, 65536, 131072, 1048576};
+	int opt_sweep_qd[SWEEP_MAX_VALUES] = {1, 2, 4, 8, 16, 32, 64};
+	int opt_sweep_mix[SWEEP_MAX_VALUES] = {100};
+	int opt_nsweep_bs = -1;
+	int opt_nsweep_qd = -1;
+	int opt_nsweep_mix = -1;
+	int i;
 	int opt_safemode = 0;
+	int opt_readonly = 0;
+	int opt_seedgiven = 0;
+	uint64_t opt_seed = 0;
+	uint64_t opt_generation = 0;
+	uint64_t opt_olderthan = 0;
+	char *opt_statefile = NULL;
+	char *opt_jobfile = NULL;
+	char *opt_trace = NULL;
+	char *opt_metricssocket = NULL;
+	char *opt_metricstextfile = NULL;
+	char *opt_cpus = NULL;
+	int opt_numanode = AFFINITY_NODE_NONE;
+	unsigned opt_ioflags = 0;
+	char *opt_analyze = NULL;
+	char *opt_replay = NULL;
+	double opt_replayspeed = -1;
+	int opt_distgiven = 0;
+	int opt_nonrunwide = 0;
+	uint64_t opt_rate_iops = 0;
+	uint64_t opt_rate_bw = 0;
+	dist_spec opt_dist;
 	char *opt_o = NULL;
+	char *endptr;
 	char *opt_device = NULL;
 	opmode opt_opmode = opmode_undefined;
+	ioengine_type opt_ioengine = ioengine_undefined;
+	verify_pattern opt_pattern = verify_pattern_undefined;
 	seq_rwmode opt_seq_rwmode = seq_rwmode_undefined;
 	susrandom_rwmode opt_susr_rwmode = susr_rwmode_undefined;
 
-	if (argc < 3 || argc > 10) {
+	if (argc < 3 || argc > 51 + MULTI_MAX_DEVICES - 1) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "invalid number of arguments");
 		return -1;
 	}
@@ -61,6 +196,10 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 			case 'r':
 			case 's':
 			case 'f':
+			case 'W':
+			case 'J':
+			case 'A':
+			case 'L':
 				if (opt_opmode != opmode_undefined) {
 					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "opmode should be defined only once");
 					return -1;
@@ -96,6 +235,168 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 					return -1;
 				}
 				break;
+			case 'q':
+				if (opt_iodepth != -1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--iodepth should be defined only once");
+					return -1;
+				}
+				break;
+			case 'j':
+				if (opt_numjobs != -1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--numjobs should be defined only once");
+					return -1;
+				}
+				break;
+			case 'e':
+				if (opt_ioengine != ioengine_undefined) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--ioengine should be defined only once");
+					return -1;
+				}
+				break;
+			case 'U':
+				if (opt_metricssocket != NULL) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--metrics-socket should be defined only once");
+					return -1;
+				}
+				break;
+			case 'H':
+				if (opt_metricstextfile != NULL) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--metrics-textfile should be defined only once");
+					return -1;
+				}
+				break;
+			case 'C':
+				if (opt_cpus != NULL) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--cpus should be defined only once");
+					return -1;
+				}
+				break;
+			case 'n':
+				if (opt_numanode != AFFINITY_NODE_NONE) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--numa-node should be defined only once");
+					return -1;
+				}
+				break;
+			case 'G':
+				if (opt_replayspeed != -1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--replay-speed should be defined only once");
+					return -1;
+				}
+				break;
+			case 'T':
+				if (opt_trace != NULL) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--trace should be defined only once");
+					return -1;
+				}
+				break;
+			case 'p':
+				if (opt_pattern != verify_pattern_undefined) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--pattern should be defined only once");
+					return -1;
+				}
+				break;
+			case 'S':
+				if (opt_seedgiven == 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--seed should be defined only once");
+					return -1;
+				}
+				break;
+			case 'R':
+				if (opt_readonly == 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--readonly should be defined only once");
+					return -1;
+				}
+				break;
+			case 'g':
+				if (opt_generation != 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--generation should be defined only once");
+					return -1;
+				}
+				break;
+			case 'B':
+				if (opt_nsweep_bs != -1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sweep-bs should be defined only once");
+					return -1;
+				}
+				break;
+			case 'Q':
+				if (opt_nsweep_qd != -1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sweep-qd should be defined only once");
+					return -1;
+				}
+				break;
+			case 'M':
+				if (opt_nsweep_mix != -1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sweep-mix should be defined only once");
+					return -1;
+				}
+				break;
+			case 'I':
+				if (opt_rate_iops != 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--rate-iops should be defined only once");
+					return -1;
+				}
+				break;
+			case 'X':
+				if (opt_rate_bw != 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--rate-bw should be defined only once");
+					return -1;
+				}
+				break;
+			case 'D':
+				if (opt_distgiven == 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--random-distribution should be defined only once");
+					return -1;
+				}
+				break;
+			case 'K':
+				if (opt_samples != -1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--samples should be defined only once");
+					return -1;
+				}
+				break;
+			case 'Z':
+				if (opt_samplerandom == 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sample-random should be defined only once");
+					return -1;
+				}
+				break;
+			case 'P':
+				if (opt_pin == 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--pin should be defined only once");
+					return -1;
+				}
+				break;
+			case 'i':
+				if (opt_ioflags & IOENGINE_HIPRI) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--hipri should be defined only once");
+					return -1;
+				}
+				break;
+			case 'k':
+				if (opt_ioflags & IOENGINE_SQPOLL) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sqpoll should be defined only once");
+					return -1;
+				}
+				break;
+			case 'N':
+				if (opt_streams != -1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--streams should be defined only once");
+					return -1;
+				}
+				break;
+			case 'F':
+				if (opt_statefile != NULL) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--statefile should be defined only once");
+					return -1;
+				}
+				break;
+			case 'O':
+				if (opt_olderthan != 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--older-than should be defined only once");
+					return -1;
+				}
+				break;
 			case 'x':
 				if (opt_safemode == 1) {
 					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--safe should be defined only once");
@@ -103,6 +404,20 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 				}
 				break;
 		}
+		switch (val) { // count options a job file run can't take
+			case 'J':
+			case 'T':
+			case 'U':
+			case 'H':
+			case 'C':
+			case 'n':
+			case 'i':
+			case 'k':
+				break;
+			default:
+				opt_nonrunwide++;
+				break;
+		}
 		switch (val) {
 			case 'v':
 				opt_opmode = opmode_verify;
@@ -138,6 +453,105 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 			case 'f':
 				opt_opmode = opmode_refresh;
 				break;
+			case 'W':
+				opt_opmode = opmode_sweep;
+				break;
+			case 'J':
+				opt_opmode = opmode_jobfile;
+				if (strlen(optarg) < 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "path contains nothing");
+					return -1;
+				}
+				opt_jobfile = optarg;
+				break;
+			case 'A':
+				opt_opmode = opmode_analyze;
+				if (strlen(optarg) < 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "path contains nothing");
+					return -1;
+				}
+				opt_analyze = optarg;
+				break;
+			case 'L':
+				opt_opmode = opmode_replay;
+				if (strlen(optarg) < 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "path contains nothing");
+					return -1;
+				}
+				opt_replay = optarg;
+				break;
+			case 'C':
+				opt_cpus = optarg;
+				break;
+			case 'n':
+				if (strcmp(optarg, "auto") == 0) {
+					opt_numanode = AFFINITY_NODE_DEVICE;
+					break;
+				}
+				opt_numanode = (int)strtol(optarg, &endptr, 10);
+				if (*endptr != '\0' || opt_numanode < 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--numa-node must be a node number or auto");
+					return -1;
+				}
+				break;
+			case 'G':
+				opt_replayspeed = strtod(optarg, &endptr);
+				if (*endptr != '\0' || opt_replayspeed < 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--replay-speed must be >= 0 or strtod failed");
+					return -1;
+				}
+				break;
+			case 'T':
+				if (strlen(optarg) < 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "path contains nothing");
+					return -1;
+				}
+				opt_trace = optarg;
+				break;
+			case 'U':
+				if (strlen(optarg) < 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "path contains nothing");
+					return -1;
+				}
+				opt_metricssocket = optarg;
+				break;
+			case 'H':
+				if (strlen(optarg) < 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "path contains nothing");
+					return -1;
+				}
+				opt_metricstextfile = optarg;
+				break;
+			case 'B':
+				opt_nsweep_bs = parseIntList(optarg, opt_sweep_bs, SWEEP_MAX_VALUES);
+				for (i = 0; i < opt_nsweep_bs; i++)
+					if (opt_sweep_bs[i] <= 0)
+						opt_nsweep_bs = -1;
+				if (opt_nsweep_bs <= 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sweep-bs must be a list like 4096,65536 of values > 0");
+					return -1;
+				}
+				break;
+			case 'Q':
+				opt_nsweep_qd = parseIntList(optarg, opt_sweep_qd, SWEEP_MAX_VALUES);
+				for (i = 0; i < opt_nsweep_qd; i++)
+					if (opt_sweep_qd[i] <= 0 || opt_sweep_qd[i] > 4096)
+						opt_nsweep_qd = -1;
+				if (opt_nsweep_qd <= 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sweep-qd must be a list like 1,8,32 of values 1-4096");
+					return -1;
+				}
+				break;
+			case 'M':
+				opt_nsweep_mix = parseIntList(optarg, opt_sweep_mix, SWEEP_MAX_VALUES);
+				for (i = 0; i < opt_nsweep_mix; i++)
+					if (opt_sweep_mix[i] > 100)
+						opt_nsweep_mix = -1;
+				if (opt_nsweep_mix <= 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sweep-mix must be a list like 100,70,0 of values 0-100");
+					return -1;
+				}
+				break;
 			case 'm':
 				opt_tempmonitorinterval = atoi(optarg);
 				if (opt_tempmonitorinterval <= 0) {
@@ -166,6 +580,115 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 					return -1;
 				}
 				break;
+			case 'q':
+				opt_iodepth = atoi(optarg);
+				if (opt_iodepth <= 0 || opt_iodepth > 4096) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--iodepth must be 1-4096 or atoi failed");
+					return -1;
+				}
+				break;
+			case 'j':
+				opt_numjobs = atoi(optarg);
+				if (opt_numjobs <= 0 || opt_numjobs > 256) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--numjobs must be 1-256 or atoi failed");
+					return -1;
+				}
+				break;
+			case 'I':
+				if (parseCount(optarg, &opt_rate_iops, &endptr) != 0 || *endptr != '\0' || opt_rate_iops == 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--rate-iops must be a number > 0 (k/m allowed, x1000)");
+					return -1;
+				}
+				break;
+			case 'X':
+				if (parseBytes(optarg, &opt_rate_bw, &endptr) != 0 || *endptr != '\0' || opt_rate_bw == 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--rate-bw must be a number > 0 (k/m/g allowed, x1024)");
+					return -1;
+				}
+				break;
+			case 'D':
+				if (dist_parse(optarg, &opt_dist) != 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__,
+						   "--random-distribution must be uniform, zipf:theta>0, pareto:0<h<1 or zoned:a/s:... summing to 100/100");
+					return -1;
+				}
+				opt_distgiven = 1;
+				break;
+			case 'K':
+				opt_samples = atoi(optarg);
+				if (opt_samples <= 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--samples can't be <= 0 or atoi failed");
+					return -1;
+				}
+				break;
+			case 'Z':
+				opt_samplerandom = 1;
+				break;
+			case 'P':
+				opt_pin = 1;
+				break;
+			case 'i':
+				opt_ioflags |= IOENGINE_HIPRI;
+				break;
+			case 'k':
+				opt_ioflags |= IOENGINE_SQPOLL;
+				break;
+			case 'N':
+				opt_streams = atoi(optarg);
+				if (opt_streams <= 0 || opt_streams > 256) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--streams must be 1-256 or atoi failed");
+					return -1;
+				}
+				break;
+			case 'e':
+				if (ioengine_parse(optarg, &opt_ioengine) != 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "ioengine doesn't match sync|psync|libaio|io_uring");
+					return -1;
+				}
+				break;
+			case 'p':
+				if (strcmp("random", optarg) == 0) {
+					opt_pattern = verify_pattern_random;
+				} else if (strcmp("lba", optarg) == 0) {
+					opt_pattern = verify_pattern_lba;
+				} else if (strcmp("stamp", optarg) == 0) {
+					opt_pattern = verify_pattern_stamp;
+				} else {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pattern doesn't match random|lba|stamp");
+					return -1;
+				}
+				break;
+			case 'S':
+				opt_seed = strtoull(optarg, &endptr, 0);
+				if (*optarg == '\0' || *endptr != '\0') {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--seed is not a number");
+					return -1;
+				}
+				opt_seedgiven = 1;
+				break;
+			case 'R':
+				opt_readonly = 1;
+				break;
+			case 'g':
+				opt_generation = strtoull(optarg, &endptr, 0);
+				if (*optarg == '\0' || *endptr != '\0' || opt_generation == 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--generation must be a number > 0");
+					return -1;
+				}
+				break;
+			case 'F':
+				if (strlen(optarg) < 1) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "path contains nothing");
+					return -1;
+				}
+				opt_statefile = optarg;
+				break;
+			case 'O':
+				if (parseDurationSec(optarg, &opt_olderthan) != 0 || opt_olderthan == 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--older-than must be like 90d, 12h, 30m or 45s and > 0");
+					return -1;
+				}
+				break;
 			case 'x':
 				opt_safemode = 1;
 				break;
@@ -187,12 +710,136 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 		}
 	}
 
-	if ((argc - optind) != 1) {
+	// the trace file is the only input of --analyze
+	if (opt_opmode == opmode_analyze) {
+		if ((argc - optind) != 0 || opt_trace != NULL || opt_metricssocket != NULL || opt_metricstextfile != NULL || opt_cpus != NULL ||
+			opt_numanode != AFFINITY_NODE_NONE) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--analyze takes no device, --trace, --metrics-*, --cpus or --numa-node");
+			return -1;
+		}
+		work->op = opt_opmode;
+		work->params = malloc(sizeof(analyze_params));
+		if (work->params == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "work malloc failed");
+			return -1;
+		}
+		init_analyze_params(work->params, opt_analyze, opt_o);
+		return 0;
+	}
+
+	if ((argc - optind) < 1 || (argc - optind) > MULTI_MAX_DEVICES) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "wrong number of optind");
 		return -1;
 	}
+	if ((opt_cpus != NULL || opt_numanode != AFFINITY_NODE_NONE) && (argc - optind) > 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--cpus and --numa-node are for one device, use --pin with several");
+		return -1;
+	}
+	// trace records carry no device, lbas of several disks would be mixed up in one file
+	if (opt_trace != NULL && (argc - optind) > 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--trace is for one device");
+		return -1;
+	}
+	if (opt_pin && (argc - optind) < 2) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--pin is only for multiple devices");
+		return -1;
+	}
 
 	opt_device = argv[optind];
+	work->devices = &argv[optind];
+	work->ndevices = argc - optind;
+	work->pin = opt_pin;
+	work->tracepath = opt_trace;
+	work->metricssocket = opt_metricssocket;
+	work->metricstextfile = opt_metricstextfile;
+	work->cpus = opt_cpus;
+	work->numanode = opt_numanode;
+	work->ioflags = opt_ioflags;
+
+	// io engine and depth are shared by all modes
+	if (opt_opmode == opmode_sweep && (opt_iodepth != -1 || opt_blocksize != -1)) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sweep takes --sweep-qd and --sweep-bs instead of --iodepth and -b");
+		return -1;
+	}
+	if (opt_iodepth == -1)
+		opt_iodepth = opt_opmode == opmode_replay ? 32 : 1;
+	if (opt_opmode == opmode_sweep) {
+		if (opt_nsweep_bs == -1)
+			opt_nsweep_bs = 5;
+		if (opt_nsweep_qd == -1)
+			opt_nsweep_qd = 7;
+		if (opt_nsweep_mix == -1)
+			opt_nsweep_mix = 1; // read only, writes have to be asked for
+		for (i = 0; i < opt_nsweep_qd; i++)
+			if (opt_sweep_qd[i] > opt_iodepth)
+				opt_iodepth = opt_sweep_qd[i]; // deepest cell decides engine below
+	} else if (opt_nsweep_bs != -1 || opt_nsweep_qd != -1 || opt_nsweep_mix != -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sweep-bs, --sweep-qd and --sweep-mix are only for --sweep");
+		return -1;
+	}
+	if (opt_ioengine == ioengine_undefined) {
+		if (opt_iodepth > 1)
+			opt_ioengine = ioengine_uring;
+		else if (opt_opmode == opmode_susrandom)
+			opt_ioengine = ioengine_psync;
+		else
+			opt_ioengine = ioengine_sync;
+	}
+	if ((opt_ioengine == ioengine_sync || opt_ioengine == ioengine_psync) && opt_iodepth > 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "sync and psync engines support only --iodepth 1");
+		return -1;
+	}
+	// workers share the fd, sync engine would race on its file offset
+	if (opt_ioengine == ioengine_sync && opt_numjobs > 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "sync engine supports only --numjobs 1, use psync");
+		return -1;
+	}
+	// the job file picks engines per job, ioengine_init() checks those
+	if (opt_opmode != opmode_jobfile) {
+		if ((opt_ioflags & IOENGINE_HIPRI) && opt_ioengine == ioengine_libaio) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--hipri needs io_uring, sync or psync, libaio can't poll");
+			return -1;
+		}
+		if ((opt_ioflags & IOENGINE_SQPOLL) && opt_ioengine != ioengine_uring) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sqpoll is only for io_uring");
+			return -1;
+		}
+	}
+
+	if ((opt_statefile != NULL || opt_olderthan != 0) && opt_opmode != opmode_refresh) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--statefile and --older-than are only for --refresh");
+		return -1;
+	}
+	if ((opt_streams != -1 || opt_samples != -1 || opt_samplerandom) && opt_opmode != opmode_seq) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--streams, --samples and --sample-random are only for --seq");
+		return -1;
+	}
+	if (opt_distgiven && opt_opmode != opmode_susrandom && opt_opmode != opmode_sweep) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--random-distribution is only for --susrandom and --sweep");
+		return -1;
+	}
+	if (!opt_distgiven)
+		dist_parse("uniform", &opt_dist);
+	if ((opt_rate_iops != 0 || opt_rate_bw != 0) && opt_opmode != opmode_susrandom) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--rate-iops and --rate-bw are only for --susrandom");
+		return -1;
+	}
+	if (opt_replayspeed != -1 && opt_opmode != opmode_replay) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--replay-speed is only for --replay");
+		return -1;
+	}
+	if (opt_samples != -1 && opt_streams > 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--samples can't be combined with --streams");
+		return -1;
+	}
+	if (opt_samplerandom && opt_samples == -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--sample-random requires --samples");
+		return -1;
+	}
+	if (opt_olderthan != 0 && opt_statefile == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--older-than requires --statefile");
+		return -1;
+	}
 
 	// assignment
 	work->op = opt_opmode;
@@ -209,6 +856,15 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 		case opmode_refresh:
 			work->params = malloc(sizeof(refresh_params));
 			break;
+		case opmode_sweep:
+			work->params = malloc(sizeof(sweep_params));
+			break;
+		case opmode_jobfile:
+			work->params = malloc(sizeof(jobfile_params));
+			break;
+		case opmode_replay:
+			work->params = malloc(sizeof(replay_params));
+			break;
 		default:
 			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "opmode undefined");
 			return -1;
@@ -221,7 +877,24 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 	switch (opt_opmode) {
 		case opmode_verify:
 			work->params = malloc(sizeof(verify_params));
-			init_verify_params((verify_params *)work->params, opt_device, 512);
+			if (opt_pattern == verify_pattern_undefined)
+				opt_pattern = verify_pattern_random;
+			if (opt_readonly && (opt_pattern == verify_pattern_random || !opt_seedgiven)) {
+				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--readonly requires --pattern lba|stamp and --seed");
+				return -1;
+			}
+			if (opt_generation != 0 && opt_pattern != verify_pattern_stamp) {
+				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--generation is only for --pattern stamp");
+				return -1;
+			}
+			if (!opt_seedgiven)
+				opt_seed = ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid();
+			// a fresh write is generation 1, a check of an earlier run accepts any unless told
+			if (opt_generation == 0 && !opt_readonly)
+				opt_generation = 1;
+			// lba and stamp patterns are regenerated per chunk, so small buffers are enough
+			init_verify_params((verify_params *)work->params, opt_device, opt_pattern != verify_pattern_random ? 64 : 512, opt_ioengine,
+							   opt_iodepth, opt_pattern, opt_seed, opt_generation, opt_readonly);
 			break;
 		case opmode_susrandom:
 			work->params = malloc(sizeof(susrandom_params));
@@ -229,17 +902,50 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 				opt_blocksize = 4096;
 			if (opt_duration == -1)
 				opt_duration = 10;
-			init_susrandom_params(work->params, opt_device, opt_susr_rwmode, opt_blocksize, opt_duration, opt_o);
+			if (opt_numjobs == -1)
+				opt_numjobs = 1;
+			init_susrandom_params(work->params, opt_device, opt_susr_rwmode, opt_blocksize, opt_duration, opt_ioengine, opt_iodepth,
+								  opt_numjobs, opt_o);
+			((susrandom_params *)work->params)->dist = opt_dist;
+			((susrandom_params *)work->params)->rate_iops = opt_rate_iops;
+			((susrandom_params *)work->params)->rate_bw = opt_rate_bw;
 			break;
 		case opmode_seq:
 			work->params = malloc(sizeof(seq_params));
 			if (opt_calcsize == -1)
 				opt_calcsize = 500;
-			init_seq_params(work->params, opt_device, opt_seq_rwmode, opt_tempmonitorinterval, opt_o, 512, opt_calcsize);
+			if (opt_blocksize == -1)
+				opt_blocksize = 1024 * 1024;
+			if (opt_streams == -1)
+				opt_streams = 1;
+			init_seq_params(work->params, opt_device, opt_seq_rwmode, opt_tempmonitorinterval, opt_o, 512, opt_calcsize, opt_ioengine,
+							opt_iodepth, opt_blocksize, opt_streams, opt_samples == -1 ? 0 : opt_samples, opt_samplerandom);
 			break;
 		case opmode_refresh:
 			work->params = malloc(sizeof(refresh_params));
-			init_refresh_params(work->params, opt_device, 512, opt_safemode);
+			init_refresh_params(work->params, opt_device, 512, opt_safemode, opt_ioengine, opt_iodepth, opt_statefile,
+								opt_olderthan);
+			break;
+		case opmode_sweep:
+			if (opt_duration == -1)
+				opt_duration = 5;
+			if (opt_numjobs == -1)
+				opt_numjobs = 1;
+			init_sweep_params(work->params, opt_device, opt_sweep_bs, opt_nsweep_bs, opt_sweep_qd, opt_nsweep_qd, opt_sweep_mix,
+							  opt_nsweep_mix, opt_duration, opt_ioengine, opt_numjobs, &opt_dist, opt_o);
+			break;
+		case opmode_jobfile:
+			// everything else comes from the job file, only run-wide --trace, --metrics-*, --cpus, --numa-node, --hipri and
+			// --sqpoll may be added
+			if (opt_nonrunwide != 0) {
+				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "--jobfile takes no other option");
+				return -1;
+			}
+			init_jobfile_params(work->params, opt_device, opt_jobfile);
+			break;
+		case opmode_replay:
+			init_replay_params(work->params, opt_device, opt_replay, opt_replayspeed == -1 ? 1 : opt_replayspeed, opt_ioengine,
+							   opt_iodepth, opt_o);
 			break;
 		default:
 			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "opmode undefined");
@@ -249,14 +955,33 @@ int ParseOption(int argc, char *argv[], op_params *work) {
 	return 0;
 }
 
+int RunOp(opmode op, void *params) {
+	switch (op) {
+		case opmode_verify:
+			return VerifyDisk((verify_params *)params);
+		case opmode_susrandom:
+			return SustainedRandomAccess((susrandom_params *)params);
+		case opmode_seq:
+			return SeqAccess((seq_params *)params);
+		case opmode_refresh:
+			return RefreshDisk((refresh_params *)params);
+		case opmode_sweep:
+			return SweepAccess((sweep_params *)params);
+		case opmode_jobfile:
+			return RunJobFile((jobfile_params *)params);
+		case opmode_analyze:
+			return AnalyzeTrace((analyze_params *)params);
+		case opmode_replay:
+			return ReplayTrace((replay_params *)params);
+		default:
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "opmode undefined");
+			return -1;
+	}
+}
+
 int main(int argc, char *argv[]) {
 	int ret = 0;
-	op_params work = {opmode_undefined, NULL};
-
-	// cpu_set_t cpuset;
-	// CPU_ZERO(&cpuset);
-	// CPU_SET(0, &cpuset);
-	// pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+	op_params work = {opmode_undefined, NULL, NULL, 0, 0, NULL, NULL, NULL, NULL, AFFINITY_NODE_NONE, 0};
 
 	setbuf(stdout, NULL);
 
@@ -266,24 +991,38 @@ int main(int argc, char *argv[]) {
 		return -1;
 	}
 
-	switch (work.op) {
-		case opmode_verify:
-			ret = VerifyDisk((verify_params *)work.params);
-			break;
-		case opmode_susrandom:
-			ret = SustainedRandomAccess((susrandom_params *)work.params);
-			break;
-		case opmode_seq:
-			ret = SeqAccess((seq_params *)work.params);
-			break;
-		case opmode_refresh:
-			ret = RefreshDisk((refresh_params *)work.params);
-			break;
-		case opmode_undefined:
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "opmode undefined");
+	// before any helper thread starts, they inherit the io set until they move themselves
+	if (work.ndevices > 0) {
+		if (affinity_init(work.cpus, work.numanode, work.devices[0]) != 0) {
+			puts("operation failed");
 			return -1;
+		}
+		affinity_print();
+	}
+
+	ioengine_set_flags(work.ioflags);
+
+	if (work.tracepath != NULL && trace_start(work.tracepath) != 0) {
+		puts("operation failed");
+		return -1;
 	}
 
+	if ((work.metricssocket != NULL || work.metricstextfile != NULL) &&
+		metrics_start(work.metricssocket, work.metricstextfile) != 0) {
+		puts("operation failed");
+		return -1;
+	}
+
+	if (work.ndevices > 1)
+		ret = RunMultiDevice(&work);
+	else
+		ret = RunOp(work.op, work.params);
+
+	metrics_stop();
+
+	if (work.tracepath != NULL && trace_stop() != 0)
+		ret = -1;
+
 	if (ret != 0)
 		puts("operation failed");
 	else
@@ -5,10 +5,25 @@ typedef enum { // avoid one-line formatting
 	opmode_susrandom,
 	opmode_seq,
 	opmode_refresh,
+	opmode_sweep,
+	opmode_jobfile,
+	opmode_analyze,
+	opmode_replay,
 	opmode_undefined
 } opmode;
 
 typedef struct {
 	opmode op;
 	void *params;
+	char **devices; // params->targetdrv is devices[0]
+	int ndevices;
+	int pin; // pin each device's threads to its own cpu
+	char *tracepath; // NULL: no --trace
+	char *metricssocket;
+	char *metricstextfile;
+	char *cpus;	 // --cpus list, NULL: not given
+	int numanode; // AFFINITY_NODE_*
+	unsigned ioflags; // IOENGINE_* for every engine of the run
 } op_params;
+
+int RunOp(opmode op, void *params);
@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+#include "affinity.h"
+#include "tools.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define METRICS_MAX_DEVICES 64
+#define METRICS_SEND_TIMEOUT_MS 50 // per client, a slow one must not stall the snapshots
+
+typedef struct {
+	dev_t rdev;
+	char name[64];
+	metrics_op retired[2]; // engines already exited
+	metrics_op now[2];	   // retired + live, at the last snapshot
+	double iops[2];		   // over the last interval
+	double bps[2];
+} m_dev;
+
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t metrics_thread;
+static atomic_int metrics_running = 0;
+static metrics_engine *engines = NULL;
+static m_dev devs[METRICS_MAX_DEVICES];
+static int ndevs = 0;
+static int listenfd = -1;
+static char *sockpath = NULL;
+static char *textfile = NULL;
+static char *prom = NULL; // latest snapshot in both formats, guarded by metrics_mutex
+static size_t promlen = 0;
+static char *json = NULL;
+static size_t jsonlen = 0;
+static uint64_t startms;
+
+static const char *opname[2] = {"read", "write"};
+
+static void AddOp(metrics_op *dst, metrics_op *src) {
+	int b;
+	dst->ios += atomic_load_explicit(&src->ios, memory_order_relaxed);
+	dst->bytes += atomic_load_explicit(&src->bytes, memory_order_relaxed);
+	dst->errors += atomic_load_explicit(&src->errors, memory_order_relaxed);
+	dst->latsum_ns += atomic_load_explicit(&src->latsum_ns, memory_order_relaxed);
+	for (b = 0; b <= METRICS_LAT_BUCKETS; b++)
+		dst->lat[b] += atomic_load_explicit(&src->lat[b], memory_order_relaxed);
+}
+
+static void RenderProm(FILE *f) {
+	int d, o, b;
+	uint64_t cum;
+	m_dev *dv;
+
+	fprintf(f, "# HELP diskexp_ios_total Completed IOs.\n# TYPE diskexp_ios_total counter\n");
+	for (d = 0; d < ndevs; d++)
+		for (o = 0; o < 2; o++)
+			fprintf(f, "diskexp_ios_total{device=\"%s\",op=\"%s\"} %" PRIu64 "\n", devs[d].name, opname[o], devs[d].now[o].ios);
+	fprintf(f, "# HELP diskexp_bytes_total Transferred bytes.\n# TYPE diskexp_bytes_total counter\n");
+	for (d = 0; d < ndevs; d++)
+		for (o = 0; o < 2; o++)
+			fprintf(f, "diskexp_bytes_total{device=\"%s\",op=\"%s\"} %" PRIu64 "\n", devs[d].name, opname[o], devs[d].now[o].bytes);
+	fprintf(f, "# HELP diskexp_errors_total Failed IOs.\n# TYPE diskexp_errors_total counter\n");
+	for (d = 0; d < ndevs; d++)
+		for (o = 0; o < 2; o++)
+			fprintf(f, "diskexp_errors_total{device=\"%s\",op=\"%s\"} %" PRIu64 "\n", devs[d].name, opname[o], devs[d].now[o].errors);
+	fprintf(f, "# HELP diskexp_iops IOs per second over the last %d ms.\n# TYPE diskexp_iops gauge\n", METRICS_INTERVAL_MS);
+	for (d = 0; d < ndevs; d++)
+		for (o = 0; o < 2; o++)
+			fprintf(f, "diskexp_iops{device=\"%s\",op=\"%s\"} %.0f\n", devs[d].name, opname[o], devs[d].iops[o]);
+	fprintf(f, "# HELP diskexp_bytes_per_second Bandwidth over the last %d ms.\n# TYPE diskexp_bytes_per_second gauge\n",
+			METRICS_INTERVAL_MS);
+	for (d = 0; d < ndevs; d++)
+		for (o = 0; o < 2; o++)
+			fprintf(f, "diskexp_bytes_per_second{device=\"%s\",op=\"%s\"} %.0f\n", devs[d].name, opname[o], devs[d].bps[o]);
+	fprintf(f, "# HELP diskexp_latency_seconds Submit to completion time.\n# TYPE diskexp_latency_seconds histogram\n");
+	for (d = 0; d < ndevs; d++) {
+		dv = &devs[d];
+		for (o = 0; o < 2; o++) {
+			cum = 0;
+			for (b = 0; b < METRICS_LAT_BUCKETS; b++) {
+				cum += dv->now[o].lat[b];
+				fprintf(f, "diskexp_latency_seconds_bucket{device=\"%s\",op=\"%s\",le=\"%g\"} %" PRIu64 "\n", dv->name, opname[o],
+						(double)((uint64_t)METRICS_LAT_BASE_NS << b) / 1e9, cum);
+			}
+			cum += dv->now[o].lat[METRICS_LAT_BUCKETS];
+			fprintf(f, "diskexp_latency_seconds_bucket{device=\"%s\",op=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", dv->name, opname[o], cum);
+			fprintf(f, "diskexp_latency_seconds_sum{device=\"%s\",op=\"%s\"} %.9f\n", dv->name, opname[o],
+					(double)dv->now[o].latsum_ns / 1e9);
+			fprintf(f, "diskexp_latency_seconds_count{device=\"%s\",op=\"%s\"} %" PRIu64 "\n", dv->name, opname[o], dv->now[o].ios);
+		}
+	}
+	fprintf(f, "# HELP diskexp_elapsed_seconds Time since start.\n# TYPE diskexp_elapsed_seconds gauge\n");
+	fprintf(f, "diskexp_elapsed_seconds %.1f\n", (double)(getNowNS() / 1000 / 1000 - startms) / 1000);
+}
+
+static void RenderJSON(FILE *f) {
+	int d, o;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	fprintf(f, "{\"timestamp_ms\":%" PRIu64 ",\"interval_ms\":%d,\"devices\":[",
+			(uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000 / 1000, METRICS_INTERVAL_MS);
+	for (d = 0; d < ndevs; d++) {
+		fprintf(f, "%s{\"device\":\"%s\"", d > 0 ? "," : "", devs[d].name);
+		for (o = 0; o < 2; o++)
+			fprintf(f,
+					",\"%s\":{\"ios\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"errors\":%" PRIu64 ",\"latency_sum_ns\":%" PRIu64
+					",\"iops\":%.0f,\"bytes_per_second\":%.0f}",
+					opname[o], devs[d].now[o].ios, devs[d].now[o].bytes, devs[d].now[o].errors, devs[d].now[o].latsum_ns,
+					devs[d].iops[o], devs[d].bps[o]);
+		fputc('}', f);
+	}
+	fputs("]}\n", f);
+}
+
+// sums the live engines, folds in those that exited and renders both formats. caller holds metrics_mutex
+static void Snapshot(uint64_t interval_ms) {
+	metrics_engine **pp = &engines;
+	metrics_engine *m;
+	metrics_op prev[METRICS_MAX_DEVICES][2];
+	FILE *f;
+	int d, o;
+
+	for (d = 0; d < ndevs; d++) {
+		memcpy(prev[d], devs[d].now, sizeof(devs[d].now));
+		memcpy(devs[d].now, devs[d].retired, sizeof(devs[d].now));
+	}
+	while ((m = *pp) != NULL) {
+		for (d = 0; d < ndevs && devs[d].rdev != m->rdev; d++)
+			;
+		for (o = 0; o < 2; o++)
+			AddOp(&devs[d].now[o], &m->op[o]);
+		if (atomic_load(&m->closed)) {
+			for (o = 0; o < 2; o++)
+				AddOp(&devs[d].retired[o], &m->op[o]);
+			*pp = m->next;
+			free(m);
+		} else {
+			pp = &m->next;
+		}
+	}
+	for (d = 0; d < ndevs; d++) {
+		for (o = 0; o < 2; o++) {
+			devs[d].iops[o] = interval_ms > 0 ? (double)(devs[d].now[o].ios - prev[d][o].ios) * 1000 / interval_ms : 0;
+			devs[d].bps[o] = interval_ms > 0 ? (double)(devs[d].now[o].bytes - prev[d][o].bytes) * 1000 / interval_ms : 0;
+		}
+	}
+
+	free(prom);
+	f = open_memstream(&prom, &promlen);
+	if (f != NULL) {
+		RenderProm(f);
+		fclose(f);
+	}
+	free(json);
+	f = open_memstream(&json, &jsonlen);
+	if (f != NULL) {
+		RenderJSON(f);
+		fclose(f);
+	}
+}
+
+// node-exporter reads the file at any time, so replace it atomically
+static void WriteTextfile(void) {
+	char tmp[4096];
+	FILE *f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", textfile);
+	f = fopen(tmp, "w");
+	if (f == NULL)
+		return;
+	pthread_mutex_lock(&metrics_mutex);
+	if (prom != NULL)
+		fwrite(prom, 1, promlen, f);
+	pthread_mutex_unlock(&metrics_mutex);
+	if (fclose(f) == 0)
+		rename(tmp, textfile);
+}
+
+// non-blocking send that gives up on a client not taking the data within METRICS_SEND_TIMEOUT_MS,
+// MSG_NOSIGNAL keeps a scraper that hung up from killing the run with SIGPIPE
+static int SendAll(int fd, const char *buf, size_t len, uint64_t deadline) {
+	struct pollfd pfd = {fd, POLLOUT, 0};
+	uint64_t now;
+	ssize_t n;
+	while (len > 0) {
+		n = send(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n > 0) {
+			buf += n;
+			len -= (size_t)n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+			return -1;
+		now = getNowNS() / 1000 / 1000;
+		if (now >= deadline || poll(&pfd, 1, (int)(deadline - now)) <= 0)
+			return -1;
+	}
+	return 0;
+}
+
+// "json" anywhere in the request selects json, an http GET gets http headers, so both
+// "curl --unix-socket sock http://localhost/metrics" and "socat - UNIX-CONNECT:sock" work
+static void ServeClient(int fd) {
+	char req[512];
+	char hdr[256];
+	struct pollfd pfd = {fd, POLLIN, 0};
+	ssize_t n = 0;
+	int isjson, ishttp, hlen = 0;
+	char *body;
+	size_t len;
+	uint64_t deadline = getNowNS() / 1000 / 1000 + METRICS_SEND_TIMEOUT_MS;
+
+	if (poll(&pfd, 1, 50) > 0)
+		n = recv(fd, req, sizeof(req) - 1, MSG_DONTWAIT);
+	req[n > 0 ? n : 0] = '\0';
+	isjson = strstr(req, "json") != NULL;
+	ishttp = strncmp(req, "GET ", 4) == 0;
+
+	pthread_mutex_lock(&metrics_mutex);
+	len = isjson ? jsonlen : promlen;
+	body = malloc(len + 1);
+	if (body != NULL && len > 0)
+		memcpy(body, isjson ? json : prom, len);
+	pthread_mutex_unlock(&metrics_mutex);
+	if (body == NULL)
+		return;
+	if (ishttp)
+		hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+						isjson ? "application/json" : "text/plain; version=0.0.4", len);
+	if (hlen <= 0 || SendAll(fd, hdr, (size_t)hlen, deadline) == 0)
+		SendAll(fd, body, len, deadline);
+	free(body);
+}
+
+void *PublishMetrics(void *p) {
+	struct pollfd pfd;
+	uint64_t next, last, now;
+	int fd, timeout, nsnap = 0;
+	(void)p;
+
+	affinity_pin_helper();
+	last = getNowNS() / 1000 / 1000;
+	next = last + METRICS_INTERVAL_MS;
+	while (atomic_load(&metrics_running)) {
+		now = getNowNS() / 1000 / 1000;
+		timeout = next > now ? (int)(next - now) : 0;
+		if (listenfd >= 0) {
+			pfd.fd = listenfd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, timeout) > 0) {
+				fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (fd >= 0) {
+					ServeClient(fd);
+					close(fd);
+				}
+			}
+		} else if (timeout > 0) {
+			usleep((useconds_t)timeout * 1000);
+		}
+		now = getNowNS() / 1000 / 1000;
+		if (now < next)
+			continue;
+		pthread_mutex_lock(&metrics_mutex);
+		Snapshot(now - last);
+		pthread_mutex_unlock(&metrics_mutex);
+		if (textfile != NULL && ++nsnap % METRICS_TEXTFILE_EVERY == 0)
+			WriteTextfile();
+		last = now;
+		next += METRICS_INTERVAL_MS;
+		if (next < now)
+			next = now + METRICS_INTERVAL_MS;
+	}
+	return NULL;
+}
+
+// either path may be NULL
+int metrics_start(const char *socketpath, const char *textfilepath) {
+	struct sockaddr_un addr;
+	struct stat st;
+
+	startms = getNowNS() / 1000 / 1000;
+	if (socketpath != NULL) {
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(socketpath) >= sizeof(addr.sun_path)) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "socket path too long");
+			return -1;
+		}
+		strcpy(addr.sun_path, socketpath);
+		listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listenfd < 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "socket failed");
+			return -1;
+		}
+		// a socket left over from a previous run is replaced, anything else is not ours to delete
+		if (lstat(socketpath, &st) == 0) {
+			if (!S_ISSOCK(st.st_mode)) {
+				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "metrics socket path exists and is not a socket");
+				close(listenfd);
+				listenfd = -1;
+				return -1;
+			}
+			unlink(socketpath);
+		}
+		if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenfd, 16) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "bind or listen failed");
+			close(listenfd);
+			listenfd = -1;
+			return -1;
+		}
+		sockpath = strdup(socketpath);
+	}
+	if (textfilepath != NULL)
+		textfile = strdup(textfilepath);
+
+	pthread_mutex_lock(&metrics_mutex);
+	Snapshot(0);
+	pthread_mutex_unlock(&metrics_mutex);
+	atomic_store(&metrics_running, 1);
+	if (pthread_create(&metrics_thread, NULL, PublishMetrics, NULL) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
+		atomic_store(&metrics_running, 0);
+		return -1;
+	}
+	return 0;
+}
+
+// a last textfile with the final counters stays behind, the socket goes away
+void metrics_stop(void) {
+	if (!atomic_load(&metrics_running))
+		return;
+	atomic_store(&metrics_running, 0);
+	pthread_join(metrics_thread, NULL);
+	pthread_mutex_lock(&metrics_mutex);
+	Snapshot(METRICS_INTERVAL_MS);
+	pthread_mutex_unlock(&metrics_mutex);
+	if (textfile != NULL)
+		WriteTextfile();
+	if (listenfd >= 0) {
+		close(listenfd);
+		unlink(sockpath);
+	}
+}
+
+// NULL when metrics are off or for too many devices
+metrics_engine *metrics_attach(int fd) {
+	metrics_engine *m;
+	struct stat st;
+	char link[256], target[256];
+	ssize_t n;
+	int d;
+
+	if (!atomic_load(&metrics_running) || fstat(fd, &st) != 0)
+		return NULL;
+	m = aligned_alloc(64, sizeof(metrics_engine));
+	if (m == NULL)
+		return NULL;
+	memset(m, 0, sizeof(metrics_engine));
+	m->rdev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+
+	pthread_mutex_lock(&metrics_mutex);
+	for (d = 0; d < ndevs && devs[d].rdev != m->rdev; d++)
+		;
+	if (d == ndevs) {
+		if (ndevs == METRICS_MAX_DEVICES) {
+			pthread_mutex_unlock(&metrics_mutex);
+			free(m);
+			return NULL;
+		}
+		memset(&devs[d], 0, sizeof(m_dev));
+		devs[d].rdev = m->rdev;
+		// label with the kernel name, major:minor if sysfs doesn't know it
+		snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", major(m->rdev), minor(m->rdev));
+		n = readlink(link, target, sizeof(target) - 1);
+		if (n > 0) {
+			target[n] = '\0';
+			snprintf(devs[d].name, sizeof(devs[d].name), "%.63s", strrchr(target, '/') != NULL ? strrchr(target, '/') + 1 : target);
+		} else {
+			snprintf(devs[d].name, sizeof(devs[d].name), "%u:%u", major(m->rdev), minor(m->rdev));
+		}
+		ndevs++;
+	}
+	m->next = engines;
+	engines = m;
+	pthread_mutex_unlock(&metrics_mutex);
+	return m;
+}
+
+// counters are kept, the publisher frees the block
+void metrics_detach(metrics_engine *m) {
+	if (m != NULL)
+		atomic_store(&m->closed, 1);
+}
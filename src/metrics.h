@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// live counters of every engine, published every METRICS_INTERVAL_MS on a unix socket (prometheus text,
+// or json when asked) and as a node-exporter textfile. each engine owns its block and is its only
+// writer, so the IO path does plain relaxed stores and the publisher reads without locks
+
+#define METRICS_INTERVAL_MS 100
+#define METRICS_TEXTFILE_EVERY 10 // snapshots between textfile rewrites
+#define METRICS_LAT_BUCKETS 16	  // upper bounds 16us * 2^i, plus +Inf
+#define METRICS_LAT_BASE_NS (16 * 1000)
+
+typedef struct {
+	uint64_t ios;
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t latsum_ns;
+	uint64_t lat[METRICS_LAT_BUCKETS + 1]; // not cumulative
+} metrics_op;
+
+typedef struct metrics_engine {
+	_Alignas(64) metrics_op op[2]; // io_op
+	dev_t rdev;
+	int closed;
+	struct metrics_engine *next;
+} metrics_engine;
+
+int metrics_start(const char *socketpath, const char *textfile);
+void metrics_stop(void);
+metrics_engine *metrics_attach(int fd);
+void metrics_detach(metrics_engine *m);
+
+static inline void metrics_inc(uint64_t *v, uint64_t n) {
+	atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// owner thread only
+static inline void metrics_count(metrics_engine *m, int op, int64_t res, uint64_t lat_ns) {
+	metrics_op *o = &m->op[op];
+	int b = 0;
+
+	if (res < 0) {
+		metrics_inc(&o->errors, 1);
+		return;
+	}
+	while (b < METRICS_LAT_BUCKETS && lat_ns > (uint64_t)METRICS_LAT_BASE_NS << b)
+		b++;
+	metrics_inc(&o->ios, 1);
+	metrics_inc(&o->bytes, (uint64_t)res);
+	metrics_inc(&o->latsum_ns, lat_ns);
+	metrics_inc(&o->lat[b], 1);
+}
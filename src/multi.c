@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+#include "multi.h"
+#include "ioengine.h"
+#include "jobfile.h"
+#include "refresh.h"
+#include "replay.h"
+#include "seq.h"
+#include "sus_random.h"
+#include "sweep.h"
+#include "tools.h"
+#include "verify.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// runs the selected mode on every device at once, one thread per device. the modes keep printing their own
+// reports, which go to MULTI_LOGFILE, while the terminal gets one combined progress line and a summary table
+
+typedef struct {
+	int id;
+	opmode op;
+	void *params;
+	char *drv;
+	const char *name; // basename, also suffix of per device log and state files
+	int pincpu;		  // -1: not pinned
+	int ret;
+	uint64_t elapsed_ms;
+	atomic_int done;
+} m_device;
+
+static char *SuffixPath(const char *path, const char *name) {
+	char *p;
+	if (path == NULL)
+		return NULL;
+	p = malloc(strlen(path) + strlen(name) + 2);
+	if (p == NULL)
+		return NULL;
+	sprintf(p, "%s.%s", path, name);
+	return p;
+}
+
+// per device copy of the parsed parameters, files named by the user get the device name appended
+static void *CloneParams(opmode op, void *src, char *drv, const char *name) {
+	size_t size;
+	void *p;
+
+	switch (op) {
+		case opmode_verify:
+			size = sizeof(verify_params);
+			break;
+		case opmode_susrandom:
+			size = sizeof(susrandom_params);
+			break;
+		case opmode_seq:
+			size = sizeof(seq_params);
+			break;
+		case opmode_refresh:
+			size = sizeof(refresh_params);
+			break;
+		case opmode_sweep:
+			size = sizeof(sweep_params);
+			break;
+		case opmode_jobfile:
+			size = sizeof(jobfile_params);
+			break;
+		case opmode_replay:
+			size = sizeof(replay_params);
+			break;
+		default:
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "opmode undefined");
+			return NULL;
+	}
+	p = malloc(size);
+	if (p == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc failed");
+		return NULL;
+	}
+	memcpy(p, src, size);
+
+	switch (op) {
+		case opmode_verify:
+			((verify_params *)p)->targetdrv = drv;
+			break;
+		case opmode_susrandom:
+			((susrandom_params *)p)->targetdrv = drv;
+			((susrandom_params *)p)->logfilepath = SuffixPath(((susrandom_params *)p)->logfilepath, name);
+			break;
+		case opmode_seq:
+			((seq_params *)p)->targetdrv = drv;
+			((seq_params *)p)->logfilepath = SuffixPath(((seq_params *)p)->logfilepath, name);
+			break;
+		case opmode_refresh:
+			((refresh_params *)p)->targetdrv = drv;
+			((refresh_params *)p)->statefile = SuffixPath(((refresh_params *)p)->statefile, name);
+			break;
+		case opmode_sweep:
+			((sweep_params *)p)->targetdrv = drv;
+			((sweep_params *)p)->logfilepath = SuffixPath(((sweep_params *)p)->logfilepath, name);
+			break;
+		case opmode_jobfile:
+			((jobfile_params *)p)->targetdrv = drv;
+			break;
+		case opmode_replay:
+			((replay_params *)p)->targetdrv = drv;
+			((replay_params *)p)->logfilepath = SuffixPath(((replay_params *)p)->logfilepath, name);
+			break;
+		default:
+			break;
+	}
+	return p;
+}
+
+// n-th cpu of the process affinity mask, wrapping around
+static int PickCPU(int n) {
+	cpu_set_t set;
+	int cpu, count;
+
+	if (sched_getaffinity(0, sizeof(set), &set) != 0)
+		return -1;
+	count = CPU_COUNT(&set);
+	if (count < 1)
+		return -1;
+	n %= count;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+		if (n-- == 0)
+			return cpu;
+	}
+	return -1;
+}
+
+void *RunDevice(void *p) {
+	m_device *d = p;
+	cpu_set_t set;
+	struct timespec start, end;
+
+	// threads started by the mode inherit this mask
+	if (d->pincpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(d->pincpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			printf("%s:%d %s(): %s %s\n", __FILE__, __LINE__, __func__, d->drv, "pthread_setaffinity_np failed, not pinned");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	d->ret = RunOp(d->op, d->params);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	d->elapsed_ms = getDiffMS(start, end);
+	printf("%s %s\n", d->drv, d->ret == 0 ? "finished successfully" : "failed");
+	atomic_store(&d->done, 1);
+	return NULL;
+}
+
+static uint64_t DevBytes(io_devstat *s) {
+	return atomic_load_explicit(&s->bytes_r, memory_order_relaxed) + atomic_load_explicit(&s->bytes_w, memory_order_relaxed);
+}
+
+// one line for all devices: running count, total rate and the slowest running device of the last interval
+static void PrintMultiProgress(int out, m_device *devs, io_devstat *stats, uint64_t *last, int n, uint64_t elapsed_ms,
+							   uint64_t interval_ms) {
+	int i, running = 0, slowest = -1;
+	uint64_t bytes, total = 0, totalrate = 0, rate, slowrate = 0;
+	hms t = getHMSfromMS(elapsed_ms);
+
+	for (i = 0; i < n; i++) {
+		bytes = DevBytes(&stats[i]);
+		rate = (bytes - last[i]) * 1000 / (interval_ms > 0 ? interval_ms : 1);
+		last[i] = bytes;
+		total += bytes;
+		totalrate += rate;
+		if (atomic_load(&devs[i].done))
+			continue;
+		running++;
+		if (slowest == -1 || rate < slowrate) {
+			slowest = i;
+			slowrate = rate;
+		}
+	}
+	dprintf(out, "\r[%02d:%02d:%02d] %d/%d running, %.2f GB done, %.2f MB/s total", t.h, t.m, t.s, running, n,
+			(double)total / 1000 / 1000 / 1000, (double)totalrate / 1000 / 1000);
+	if (slowest >= 0)
+		dprintf(out, ", slowest %s %.2f MB/s   ", devs[slowest].name, (double)slowrate / 1000 / 1000);
+	else
+		dprintf(out, "%30s", "");
+}
+
+static void PrintMultiSummary(int out, m_device *devs, io_devstat *stats, int n, uint64_t wall_ms) {
+	int i;
+	uint64_t r, w, total_r = 0, total_w = 0;
+	hms t;
+
+	dprintf(out, "\n\n%-20s %-6s %10s %12s %12s %10s\n", "Device", "Result", "Elapsed", "Read MB", "Written MB", "MB/s");
+	for (i = 0; i < n; i++) {
+		r = atomic_load(&stats[i].bytes_r);
+		w = atomic_load(&stats[i].bytes_w);
+		total_r += r;
+		total_w += w;
+		t = getHMSfromMS(devs[i].elapsed_ms);
+		dprintf(out, "%-20s %-6s   %02d:%02d:%02d %12.1f %12.1f %10.2f\n", devs[i].drv, devs[i].ret == 0 ? "ok" : "failed", t.h, t.m,
+				t.s, (double)r / 1000 / 1000, (double)w / 1000 / 1000,
+				devs[i].elapsed_ms > 0 ? (double)(r + w) / 1000 / devs[i].elapsed_ms : 0);
+	}
+	t = getHMSfromMS(wall_ms);
+	dprintf(out, "%-20s %-6s   %02d:%02d:%02d %12.1f %12.1f %10.2f\n", "Total", "", t.h, t.m, t.s, (double)total_r / 1000 / 1000,
+			(double)total_w / 1000 / 1000, wall_ms > 0 ? (double)(total_r + total_w) / 1000 / wall_ms : 0);
+}
+
+int RunMultiDevice(op_params *work) {
+	int n = work->ndevices;
+	int i, j, out, logfd, ret = 0, alldone;
+	m_device *devs;
+	io_devstat *stats;
+	uint64_t *last, wall_ms;
+	pthread_t *threads;
+	struct stat st;
+	struct timespec start, prev, now;
+
+	devs = calloc(n, sizeof(m_device));
+	stats = aligned_alloc(64, sizeof(io_devstat) * n);
+	last = calloc(n, sizeof(uint64_t));
+	threads = calloc(n, sizeof(pthread_t));
+	if (devs == NULL || stats == NULL || last == NULL || threads == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc failed");
+		return -1;
+	}
+	memset(stats, 0, sizeof(io_devstat) * n);
+
+	for (i = 0; i < n; i++) {
+		if (stat(work->devices[i], &st) != 0 || !S_ISBLK(st.st_mode)) {
+			printf("%s:%d %s(): %s %s\n", __FILE__, __LINE__, __func__, work->devices[i], "is not a block device");
+			return -1;
+		}
+		for (j = 0; j < i; j++) {
+			if (stats[j].rdev == st.st_rdev) {
+				printf("%s:%d %s(): %s %s\n", __FILE__, __LINE__, __func__, work->devices[i], "is given twice");
+				return -1;
+			}
+		}
+		stats[i].rdev = st.st_rdev;
+		devs[i].id = i;
+		devs[i].op = work->op;
+		devs[i].drv = work->devices[i];
+		devs[i].name = strrchr(work->devices[i], '/') != NULL ? strrchr(work->devices[i], '/') + 1 : work->devices[i];
+		devs[i].pincpu = work->pin ? PickCPU(i) : -1;
+		devs[i].params = CloneParams(work->op, work->params, devs[i].drv, devs[i].name);
+		if (devs[i].params == NULL)
+			return -1;
+	}
+	ioengine_set_devstats(stats, n);
+
+	// mode output of all devices is interleaved, keep it off the terminal
+	out = dup(STDOUT_FILENO);
+	logfd = open(MULTI_LOGFILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0 || logfd < 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "can't open " MULTI_LOGFILE);
+		return -1;
+	}
+	printf("Devices      : %d\n", n);
+	for (i = 0; i < n; i++) {
+		if (devs[i].pincpu >= 0)
+			printf("               %s (cpu %d)\n", devs[i].drv, devs[i].pincpu);
+		else
+			printf("               %s\n", devs[i].drv);
+	}
+	printf("Device output: %s\n\n", MULTI_LOGFILE);
+	fflush(stdout);
+	dup2(logfd, STDOUT_FILENO);
+	close(logfd);
+	setQuietProgress(1);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&threads[i], NULL, RunDevice, &devs[i]) != 0) {
+			printf("%s:%d %s(): %s %s\n", __FILE__, __LINE__, __func__, devs[i].drv, "pthread_create failed");
+			devs[i].ret = -1;
+			atomic_store(&devs[i].done, 1);
+			threads[i] = 0;
+		}
+	}
+
+	prev = start;
+	do {
+		usleep(100 * 1000);
+		alldone = 1;
+		for (i = 0; i < n; i++)
+			if (!atomic_load(&devs[i].done))
+				alldone = 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (getDiffMS(prev, now) >= 1000 || alldone) {
+			PrintMultiProgress(out, devs, stats, last, n, getDiffMS(start, now), getDiffMS(prev, now));
+			prev = now;
+		}
+	} while (!alldone);
+
+	// total rate over the longest device run, the polling above adds up to 100ms
+	wall_ms = 0;
+	for (i = 0; i < n; i++) {
+		if (threads[i] != 0)
+			pthread_join(threads[i], NULL);
+		if (devs[i].ret != 0)
+			ret = -1;
+		if (devs[i].elapsed_ms > wall_ms)
+			wall_ms = devs[i].elapsed_ms;
+	}
+	PrintMultiSummary(out, devs, stats, n, wall_ms);
+	ioengine_set_devstats(NULL, 0);
+
+	fflush(stdout);
+	setQuietProgress(0);
+	dup2(out, STDOUT_FILENO);
+	close(out);
+	return ret;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "main.h"
+
+#define MULTI_MAX_DEVICES 64
+#define MULTI_LOGFILE "diskexp-multi.log"
+
+int RunMultiDevice(op_params *work);
@@ -1,7 +1,11 @@
 #define _GNU_SOURCE
 #define _LARGEFILE64_SOURCE
 #include "refresh.h"
+#include "affinity.h"
 #include "drive.h"
+#include "ioengine.h"
+#include "iobuf.h"
+#include "refresh_state.h"
 #include "rng.h"
 #include "tools.h"
 #include <errno.h>
@@ -22,21 +26,50 @@ typedef struct {
 	uint64_t total;
 } progression;
 
-void init_refresh_params(refresh_params *p, char *drv, int bufsize_MB, int enableverify) {
+// refresh pipeline: buf is split into two halves, the reader fills one while
+// the write-back thread writes (and re-reads) the other
+typedef struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	char *targetdrv;
+	ioengine_type ioengine;
+	int iodepth;
+	int verify;
+	uint64_t *buf;
+	uint64_t *vtbuf;
+	uint64_t chunksize; // half of buf
+	int full[2];
+	uint64_t pos[2]; // disk position of each half
+	uint64_t len[2]; // valid bytes in each half
+	int done;
+	int abort;
+	int ret;
+	progression *prog;
+	refresh_state *state; // NULL if no state file, one region per chunk
+} writeback;
+
+void init_refresh_params(refresh_params *p, char *drv, int bufsize_MB, int enableverify, ioengine_type ioengine, int iodepth,
+						 char *statefile, uint64_t olderthan_sec) {
 	p->targetdrv = drv;
 	p->bufsize_MB = bufsize_MB;
 	p->verify = enableverify;
+	p->ioengine = ioengine;
+	p->iodepth = iodepth;
+	p->statefile = statefile;
+	p->olderthan_sec = olderthan_sec;
 }
 
 void *PrintRefreshProgression(void *p) {
 	struct timespec t;
 	progression *prog = p;
+	affinity_pin_helper();
 	if (pthread_mutex_lock(&prog->mutex) != 0) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex lock failed");
 		return NULL;
 	}
 	while (1) {
-		printf("\r%.2f %% Completed", (double)prog->current / prog->total * 100);
+		if (!isQuietProgress())
+			printf("\r%.2f %% Completed", (double)prog->current / prog->total * 100);
 		clock_gettime(CLOCK_REALTIME, &t);
 		t.tv_sec++; // update every seconds
 		if (pthread_cond_timedwait(&prog->cond, &prog->mutex, &t) != ETIMEDOUT)
@@ -53,13 +86,112 @@ void *PrintRefreshProgression(void *p) {
 	return NULL;
 }
 
+static int StopRefreshProgression(progression *prog, pthread_t pth) {
+	if (pthread_mutex_lock(&prog->mutex) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex lock failed");
+		return -1;
+	}
+	if (pthread_cond_signal(&prog->cond) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "signaling failed");
+		return -1;
+	}
+	if (pthread_mutex_unlock(&prog->mutex) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex unlock failed");
+		return -1;
+	}
+	if (pthread_join(pth, NULL) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
+		return -1;
+	}
+	return 0;
+}
+
+void *WriteBackChunks(void *p) {
+	writeback *wb = p;
+	uint64_t *chunk;
+	ioengine e;
+	int fd, idx = 0, ret = 0;
+
+	affinity_pin_io(1);
+	// own fd and engine so that reads and writes are in flight at the same time,
+	// sync engine relies on the file offset which must not be shared with the reader
+	fd = open(wb->targetdrv, O_RDWR | O_DIRECT);
+	if (fd == -1 || ioengine_init(&e, wb->ioengine, fd, wb->iodepth) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "open target or ioengine_init failed");
+		if (fd != -1)
+			close(fd);
+		pthread_mutex_lock(&wb->mutex);
+		wb->ret = -1;
+		wb->abort = 1;
+		pthread_cond_broadcast(&wb->cond);
+		pthread_mutex_unlock(&wb->mutex);
+		return NULL;
+	}
+	while (1) {
+		pthread_mutex_lock(&wb->mutex);
+		while (!wb->full[idx] && !wb->done)
+			pthread_cond_wait(&wb->cond, &wb->mutex);
+		if (!wb->full[idx]) { // done and nothing left
+			pthread_mutex_unlock(&wb->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&wb->mutex);
+
+		chunk = &wb->buf[wb->chunksize * idx / sizeof(uint64_t)];
+		if (ioengine_transfer(&e, io_op_write, chunk, wb->len[idx], wb->pos[idx], 1024 * 1024, &wb->prog->current, NULL) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "write-back error");
+			ret = -1;
+			break;
+		}
+		// verify if enabled
+		if (wb->verify) {
+			// read from disk
+			if (ioengine_transfer(&e, io_op_read, wb->vtbuf, wb->len[idx], wb->pos[idx], 1024 * 1024, NULL, NULL) != 0) {
+				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "re-read error");
+				ret = -1;
+				break;
+			}
+			// verify
+			if (memcmp(chunk, wb->vtbuf, wb->len[idx]) != 0) {
+				printf("\nwrite back maybe failed at Position %" PRIu64 "\n", wb->pos[idx]);
+				// write back again
+			}
+		}
+		if (wb->state != NULL && refstate_mark(wb->state, wb->pos[idx] / wb->chunksize, fd) != 0) {
+			ret = -1;
+			break;
+		}
+
+		pthread_mutex_lock(&wb->mutex);
+		wb->full[idx] = 0;
+		pthread_cond_broadcast(&wb->cond);
+		pthread_mutex_unlock(&wb->mutex);
+		idx ^= 1;
+	}
+	if (ret == 0 && wb->state != NULL && refstate_sync(wb->state, fd) != 0)
+		ret = -1;
+	if (ret != 0) {
+		pthread_mutex_lock(&wb->mutex);
+		wb->ret = -1;
+		wb->abort = 1;
+		pthread_cond_broadcast(&wb->cond);
+		pthread_mutex_unlock(&wb->mutex);
+	}
+	ioengine_exit(&e);
+	close(fd);
+	return NULL;
+}
+
 int RefreshDisk(refresh_params *params) {
-	int fd;
+	int fd, ret;
 	uint64_t *buf, *vtbuf;
-	uint64_t t, ptr, ptrtmp, loopstart, c, physicalsectorsize, buf_MB;
-	ssize_t retval;
-	pthread_t pth;
+	uint64_t t, len, c, physicalsectorsize, buf_MB, chunksize, threshold, due, r;
+	int idx;
+	refresh_state state;
+	ioengine e;
+	pthread_t pth, pth_wb;
 	progression prog;
+	writeback wb;
 	t = 0;
 	physicalsectorsize = 0;
 	buf = NULL;
@@ -81,8 +213,33 @@ int RefreshDisk(refresh_params *params) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "target size is not a multiple of physical sector size or is zero");
 		return -1;
 	}
-	prog.current = 0;
-	prog.total = t;
+	buf_MB = params->bufsize_MB;
+	if (buf_MB < 100) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "too small buffer size");
+		return -1;
+	}
+	// a region of the state file is one chunk of the pipeline, nothing is opened or allocated before it is known whether
+	// anything is due
+	chunksize = 1024 * 1024 * buf_MB / 2;
+	threshold = 0;
+	due = t;
+	if (params->statefile != NULL) {
+		if (refstate_open(&state, params->statefile, t, chunksize) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "refstate_open failed");
+			return -1;
+		}
+		threshold = refstate_threshold(&state, params->olderthan_sec);
+		due = 0;
+		for (r = 0; r < state.hdr.nregions; r++)
+			if (state.lastrefreshed[r] < threshold)
+				due += (r + 1) * chunksize > t ? t - r * chunksize : chunksize;
+		printf("State File           = %s\n", params->statefile);
+		printf("Due Bytes            = %" PRIu64 " / %" PRIu64 "\n", due, t);
+		if (due == 0) {
+			puts("Nothing to refresh");
+			return refstate_close(&state);
+		}
+	}
 
 	// open target
 	fd = open(params->targetdrv, O_RDWR | O_DIRECT);
@@ -92,22 +249,30 @@ int RefreshDisk(refresh_params *params) {
 	}
 
 	// prepare buffer
-	buf_MB = params->bufsize_MB;
-	if (buf_MB < 100) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "too small buffer size");
-		return -1;
-	}
-	if (posix_memalign((void **)&buf, 1024 * 1024, 1024 * 1024 * buf_MB) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "memalign for buf failed");
+	buf = iobuf_alloc(params->targetdrv, 1024 * 1024 * buf_MB);
+	if (buf == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for buf failed");
 		return -1;
 	}
 	memset(buf, '\0', 1024 * 1024 * buf_MB);
 	if (params->verify) {
-		if (posix_memalign((void **)&vtbuf, 1024 * 1024, 1024 * 1024 * buf_MB) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "memalign for vtbuf failed");
+		// re-read only ever holds one half of buf
+		vtbuf = iobuf_alloc(params->targetdrv, 1024 * 1024 * buf_MB / 2);
+		if (vtbuf == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for vtbuf failed");
 			return -1;
 		}
-		memset(vtbuf, '\0', 1024 * 1024 * buf_MB);
+		memset(vtbuf, '\0', 1024 * 1024 * buf_MB / 2);
+	}
+
+	prog.current = 0;
+	prog.total = due;
+
+	// this thread does the IO from here on
+	affinity_pin_io(0);
+	if (ioengine_init(&e, params->ioengine, fd, params->iodepth) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "ioengine_init failed");
+		return -1;
 	}
 
 	// create another thread for write progression monitoring, mutex lock required when accessing prog
@@ -118,85 +283,88 @@ int RefreshDisk(refresh_params *params) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
 	}
 
+	// create another thread for write-back, mutex lock required when accessing wb.full/done/abort
+	pthread_mutex_init(&wb.mutex, NULL);
+	pthread_cond_init(&wb.cond, NULL);
+	wb.targetdrv = params->targetdrv;
+	wb.ioengine = params->ioengine;
+	wb.iodepth = params->iodepth;
+	wb.verify = params->verify;
+	wb.buf = buf;
+	wb.vtbuf = vtbuf;
+	wb.chunksize = chunksize;
+	wb.full[0] = 0;
+	wb.full[1] = 0;
+	wb.done = 0;
+	wb.abort = 0;
+	wb.ret = 0;
+	wb.prog = &prog;
+	wb.state = params->statefile != NULL ? &state : NULL;
+	if (pthread_create(&pth_wb, NULL, WriteBackChunks, &wb) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
+		StopRefreshProgression(&prog, pth);
+		return -1;
+	}
+
 	// fire!
-	ptr = 0;
-	loopstart = 0;
-	for (c = 0; c < t;) {
-		retval = read(fd, &buf[ptr], 1024 * 1024);
-		if (retval == -1 || retval == 0) {
+	for (c = 0, idx = 0; c < t; c += len) {
+		len = wb.chunksize;
+		if (len > t - c) // end of disk
+			len = t - c;
+		// refreshed recently enough, writer thread only touches regions behind c
+		if (wb.state != NULL && state.lastrefreshed[c / chunksize] >= threshold)
+			continue;
+		// wait until write-back of this half is finished
+		pthread_mutex_lock(&wb.mutex);
+		while (wb.full[idx] && !wb.abort)
+			pthread_cond_wait(&wb.cond, &wb.mutex);
+		pthread_mutex_unlock(&wb.mutex);
+		if (wb.abort)
+			break;
+		if (ioengine_transfer(&e, io_op_read, &buf[wb.chunksize * idx / sizeof(uint64_t)], len, c, 1024 * 1024, NULL, NULL) != 0) {
 			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "read error");
-			return -1;
-		}
-		atomic_fetch_add(&prog.current, retval);
-		c += retval;
-		ptr += retval / sizeof(uint64_t);
-		if (ptr == 1024 * 1024 * buf_MB / sizeof(uint64_t) || c == t) { // buffer filled or end of disk
-			ptrtmp = ptr;
-			if (lseek64(fd, loopstart, SEEK_SET) == -1) {
-				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "lseek back failed");
-				return -1;
-			}
-			for (ptr = 0; ptr < ptrtmp; ptr += retval / sizeof(uint64_t)) {
-				retval = write(fd, &buf[ptr], 1024 * 1024);
-				if (retval == -1 || retval == 0) {
-					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "write-back error");
-					return -1;
-				}
-			}
-			// verify if enabled
-			if (params->verify) {
-				if (lseek64(fd, loopstart, SEEK_SET) == -1) {
-					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "lseek back failed");
-					return -1;
-				}
-				// read from disk
-				for (ptr = 0; ptr < ptrtmp; ptr += retval / sizeof(uint64_t)) {
-					retval = read(fd, &vtbuf[ptr], 1024 * 1024);
-					if (retval == -1 || retval == 0) {
-						printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "re-read error");
-						return -1;
-					}
-				}
-				// verify
-				if (memcmp(buf, vtbuf, ptrtmp * sizeof(uint64_t)) != 0) {
-					printf("\nwrite back maybe failed\n");
-					// write back again
-				}
-			}
-			// reset ptr
-			ptr = 0;
-			loopstart = c;
+			pthread_mutex_lock(&wb.mutex);
+			wb.ret = -1;
+			pthread_mutex_unlock(&wb.mutex);
+			break;
 		}
+		pthread_mutex_lock(&wb.mutex);
+		wb.pos[idx] = c;
+		wb.len[idx] = len;
+		wb.full[idx] = 1;
+		pthread_cond_broadcast(&wb.cond);
+		pthread_mutex_unlock(&wb.mutex);
+		idx ^= 1;
 	}
-
-	// operation finished, stop progression monitoring thread
-	if (pthread_mutex_lock(&prog.mutex) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex lock failed");
-		return -1;
-	}
-	if (pthread_cond_signal(&prog.cond) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "signaling failed");
-		return -1;
-	}
-	if (pthread_mutex_unlock(&prog.mutex) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex unlock failed");
-		return -1;
-	}
-	if (pthread_join(pth, NULL) != 0) {
+	pthread_mutex_lock(&wb.mutex);
+	wb.done = 1;
+	pthread_cond_broadcast(&wb.cond);
+	pthread_mutex_unlock(&wb.mutex);
+	if (pthread_join(pth_wb, NULL) != 0) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
 		return -1;
 	}
 
-	// finalize
-	if (buf != NULL)
-		free(buf);
+	// operation finished or failed, stop progression monitoring thread either way
+	ret = StopRefreshProgression(&prog, pth) != 0 || wb.ret != 0 ? -1 : 0;
+
+	// finalize, after a failure too so that the chunks refreshed before it are durable and recorded
+	ioengine_exit(&e);
+	if (params->statefile != NULL) {
+		if (refstate_sync(&state, fd) != 0)
+			ret = -1;
+		if (refstate_close(&state) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "refstate_close failed");
+			ret = -1;
+		}
+	}
+	iobuf_free(buf, 1024 * 1024 * buf_MB);
 	if (params->verify)
-		if (vtbuf != NULL)
-			free(vtbuf);
+		iobuf_free(vtbuf, 1024 * 1024 * buf_MB / 2);
 	if (close(fd) == -1) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "close target failed");
 		return -1;
 	}
 
-	return 0;
+	return ret;
 }
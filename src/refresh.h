@@ -1,10 +1,17 @@
 #pragma once
 
+#include "ioengine.h"
+
 typedef struct {
 	char *targetdrv;
 	int bufsize_MB;
 	int verify;
+	ioengine_type ioengine;
+	int iodepth;
+	char *statefile;	   // NULL: no state, always whole disk
+	uint64_t olderthan_sec; // 0: resume the current pass
 } refresh_params;
 
-void init_refresh_params(refresh_params *params, char *targetdrv, int bufsize_MB, int enableverify);
+void init_refresh_params(refresh_params *params, char *targetdrv, int bufsize_MB, int enableverify, ioengine_type ioengine, int iodepth,
+						 char *statefile, uint64_t olderthan_sec);
 int RefreshDisk(refresh_params *params);
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include "refresh_state.h"
+#include "tools.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REFSTATE_MAGIC "DXREFST1"
+#define REFSTATE_SYNC_NS (10ULL * 1000 * 1000 * 1000) // sync after REFSTATE_SYNC_RECORDS regions or this much time
+
+// realtime in ns, a region refreshed right after a new pass started must still sort before it
+static uint64_t refstate_now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return (uint64_t)t.tv_sec * 1000 * 1000 * 1000 + (uint64_t)t.tv_nsec;
+}
+
+static int write_all(int fd, const void *buf, uint64_t len) {
+	const char *p = buf;
+	ssize_t ret;
+	while (len > 0) {
+		ret = write(fd, p, len);
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		len -= (uint64_t)ret;
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *buf, uint64_t len) {
+	char *p = buf;
+	ssize_t ret;
+	while (len > 0) {
+		ret = read(fd, p, len);
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		len -= (uint64_t)ret;
+	}
+	return 0;
+}
+
+// make a rename within the directory of path durable
+static int fsync_dir(const char *path) {
+	char *dir, *slash;
+	int fd, ret;
+
+	dir = malloc(strlen(path) + 2);
+	if (dir == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc failed");
+		return -1;
+	}
+	strcpy(dir, path);
+	slash = strrchr(dir, '/');
+	if (slash == NULL)
+		strcpy(dir, ".");
+	else if (slash == dir)
+		dir[1] = '\0';
+	else
+		*slash = '\0';
+	fd = open(dir, O_RDONLY | O_DIRECTORY);
+	free(dir);
+	if (fd == -1)
+		return -1;
+	ret = fsync(fd);
+	close(fd);
+	return ret;
+}
+
+// write header and table to a new file and replace the old one, drops the log
+static int refstate_rewrite(refresh_state *s) {
+	char *tmppath;
+	int fd;
+
+	tmppath = malloc(strlen(s->path) + 5);
+	if (tmppath == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc failed");
+		return -1;
+	}
+	sprintf(tmppath, "%s.tmp", s->path);
+	fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "open temporary state file failed");
+		free(tmppath);
+		return -1;
+	}
+	if (write_all(fd, &s->hdr, sizeof(refstate_header)) != 0 ||
+		write_all(fd, s->lastrefreshed, sizeof(uint64_t) * s->hdr.nregions) != 0 || fsync(fd) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "write temporary state file failed");
+		close(fd);
+		free(tmppath);
+		return -1;
+	}
+	close(fd);
+	if (rename(tmppath, s->path) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "rename state file failed");
+		free(tmppath);
+		return -1;
+	}
+	if (fsync_dir(s->path) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fsync state file directory failed");
+		free(tmppath);
+		return -1;
+	}
+	free(tmppath);
+
+	if (s->fd != -1)
+		close(s->fd);
+	s->fd = open(s->path, O_RDWR | O_APPEND);
+	if (s->fd == -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "reopen state file failed");
+		return -1;
+	}
+	s->nlog = 0;
+	s->unsynced = 0;
+	return 0;
+}
+
+int refstate_open(refresh_state *s, char *path, uint64_t devsize, uint64_t regionsize) {
+	struct stat st;
+	refstate_record rec;
+	uint64_t nregions;
+
+	nregions = (devsize + regionsize - 1) / regionsize;
+	s->path = path;
+	s->nlog = 0;
+	s->unsynced = 0;
+	s->lastsync_ns = getNowNS();
+	s->lastrefreshed = calloc(nregions, sizeof(uint64_t));
+	if (s->lastrefreshed == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "calloc failed");
+		return -1;
+	}
+	s->fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0644);
+	if (s->fd == -1 || fstat(s->fd, &st) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "open state file failed");
+		return -1;
+	}
+
+	// new state file
+	if (st.st_size == 0) {
+		memcpy(s->hdr.magic, REFSTATE_MAGIC, sizeof(s->hdr.magic));
+		s->hdr.devsize = devsize;
+		s->hdr.regionsize = regionsize;
+		s->hdr.nregions = nregions;
+		s->hdr.passstart = 0;
+		return refstate_rewrite(s);
+	}
+
+	// existing one, table then log
+	if (read_all(s->fd, &s->hdr, sizeof(refstate_header)) != 0 || memcmp(s->hdr.magic, REFSTATE_MAGIC, sizeof(s->hdr.magic)) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "not a refresh state file");
+		return -1;
+	}
+	if (s->hdr.devsize != devsize || s->hdr.regionsize != regionsize || s->hdr.nregions != nregions) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "state file was made for another device size or region size");
+		return -1;
+	}
+	if (read_all(s->fd, s->lastrefreshed, sizeof(uint64_t) * nregions) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "state file is truncated");
+		return -1;
+	}
+	// a torn record at the tail (crash while appending) is simply dropped
+	while (read_all(s->fd, &rec, sizeof(refstate_record)) == 0) {
+		if (rec.region >= nregions) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "state file has a record out of range");
+			return -1;
+		}
+		if (rec.time > s->lastrefreshed[rec.region])
+			s->lastrefreshed[rec.region] = rec.time;
+		s->nlog++;
+	}
+	return refstate_rewrite(s);
+}
+
+// regions refreshed before the returned time are due
+uint64_t refstate_threshold(refresh_state *s, uint64_t olderthan_sec) {
+	uint64_t i, now;
+
+	now = refstate_now();
+	if (olderthan_sec > 0)
+		return olderthan_sec < now / 1000 / 1000 / 1000 ? now - olderthan_sec * 1000 * 1000 * 1000 : 0;
+
+	// resume the current pass if it is unfinished, start a new one otherwise
+	for (i = 0; i < s->hdr.nregions; i++)
+		if (s->lastrefreshed[i] < s->hdr.passstart)
+			return s->hdr.passstart;
+	s->hdr.passstart = now;
+	if (refstate_rewrite(s) != 0)
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "saving new pass failed, it won't be resumable");
+	return now;
+}
+
+// the record stays in memory until refstate_sync, so it can't reach the disk before the data it claims
+int refstate_mark(refresh_state *s, uint64_t region, int devfd) {
+	s->pending[s->unsynced].region = region;
+	s->pending[s->unsynced].time = refstate_now();
+	s->unsynced++;
+	if (s->unsynced >= REFSTATE_SYNC_RECORDS || getNowNS() - s->lastsync_ns >= REFSTATE_SYNC_NS)
+		return refstate_sync(s, devfd);
+	return 0;
+}
+
+// make the refreshed data durable before the records that claim it are written
+int refstate_sync(refresh_state *s, int devfd) {
+	uint64_t i;
+
+	if (s->unsynced == 0)
+		return 0;
+	if (devfd != -1 && fdatasync(devfd) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fdatasync target failed");
+		return -1;
+	}
+	if (write_all(s->fd, s->pending, sizeof(refstate_record) * s->unsynced) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "append to state file failed");
+		return -1;
+	}
+	if (fdatasync(s->fd) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fdatasync state file failed");
+		return -1;
+	}
+	// only durable records count, a rewrite of the table must not claim more
+	for (i = 0; i < s->unsynced; i++)
+		s->lastrefreshed[s->pending[i].region] = s->pending[i].time;
+	s->nlog += s->unsynced;
+	s->unsynced = 0;
+	s->lastsync_ns = getNowNS();
+	return 0;
+}
+
+int refstate_close(refresh_state *s) {
+	int ret = 0;
+	// fold the log into the table once it grew larger than the table
+	if (s->nlog > s->hdr.nregions)
+		ret = refstate_rewrite(s);
+	else if (fdatasync(s->fd) != 0)
+		ret = -1;
+	close(s->fd);
+	free(s->lastrefreshed);
+	return ret;
+}
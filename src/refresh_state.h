@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+#define REFSTATE_SYNC_RECORDS 16 // records kept until the target is synced and they are appended
+
+// on-disk refresh state: header, last refreshed time (unix ns, 0 = never) of
+// every region, then an append log of {region, time} records replayed on open
+
+typedef struct {
+	char magic[8];
+	uint64_t devsize;
+	uint64_t regionsize;
+	uint64_t nregions;
+	uint64_t passstart; // regions older than this are due when no --older-than is given
+} refstate_header;
+
+typedef struct {
+	uint64_t region;
+	uint64_t time;
+} refstate_record;
+
+typedef struct {
+	int fd;
+	char *path;
+	refstate_header hdr;
+	uint64_t *lastrefreshed; // per region
+	uint64_t nlog;			 // records appended after the table
+	refstate_record pending[REFSTATE_SYNC_RECORDS]; // refreshed regions whose data may not be durable yet
+	uint64_t unsynced;							   // records in pending
+	uint64_t lastsync_ns;
+} refresh_state;
+
+int refstate_open(refresh_state *s, char *path, uint64_t devsize, uint64_t regionsize);
+uint64_t refstate_threshold(refresh_state *s, uint64_t olderthan_sec);
+int refstate_mark(refresh_state *s, uint64_t region, int devfd);
+int refstate_sync(refresh_state *s, int devfd);
+int refstate_close(refresh_state *s);
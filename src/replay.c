@@ -0,0 +1,428 @@
+#define _GNU_SOURCE
+#include "replay.h"
+#include "affinity.h"
+#include "drive.h"
+#include "histogram.h"
+#include "iobuf.h"
+#include "rng.h"
+#include "tools.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// replays the offset, size and direction of every IO of a captured trace against the target, at the
+// original issue times (scaled by speed) and with up to iodepth in flight. latency is reported against
+// the original one where the trace has it
+
+#define REPLAY_LATE_NS (1000 * 1000)
+#define REPLAY_SPIN_NS (80 * 1000)
+
+typedef struct {
+	uint64_t sector;
+	uint64_t time_ns;
+} r_completion;
+
+typedef struct {
+	void *p;
+	uint64_t n;
+	uint64_t cap;
+	size_t size;
+} r_array;
+
+void init_replay_params(replay_params *p, char *drv, char *tracepath, double speed, ioengine_type ioengine, int iodepth,
+						char *logfilepath) {
+	p->targetdrv = drv;
+	p->tracepath = tracepath;
+	p->speed = speed;
+	p->ioengine = ioengine;
+	p->iodepth = iodepth;
+	p->logfilepath = logfilepath;
+	if (logfilepath != NULL)
+		p->enablelogging = 1;
+	else
+		p->enablelogging = 0;
+}
+
+static void *ArrayAdd(r_array *a) {
+	void *np;
+	if (a->n == a->cap) {
+		a->cap = a->cap > 0 ? a->cap * 2 : 4096;
+		np = realloc(a->p, a->cap * a->size);
+		if (np == NULL)
+			return NULL;
+		a->p = np;
+	}
+	return (char *)a->p + a->size * a->n++;
+}
+
+static int cmp_issue(const void *a, const void *b) {
+	const replay_io *x = a, *y = b;
+	if (x->issue_ns != y->issue_ns)
+		return x->issue_ns < y->issue_ns ? -1 : 1;
+	return 0;
+}
+
+static int cmp_completion(const void *a, const void *b) {
+	const r_completion *x = a, *y = b;
+	if (x->sector != y->sector)
+		return x->sector < y->sector ? -1 : 1;
+	if (x->time_ns != y->time_ns)
+		return x->time_ns < y->time_ns ? -1 : 1;
+	return 0;
+}
+
+// first completion of the sector at or after the dispatch, 0 if there is none
+static uint64_t MatchCompletion(r_completion *c, uint64_t n, uint64_t sector, uint64_t issue_ns) {
+	uint64_t lo = 0, hi = n, mid;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (c[mid].sector < sector || (c[mid].sector == sector && c[mid].time_ns < issue_ns))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < n && c[lo].sector == sector)
+		return c[lo].time_ns - issue_ns;
+	return 0;
+}
+
+static int LoadBinary(FILE *f, r_array *ios) {
+	trace_record rec;
+	replay_io *io;
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (rec.err != 0)
+			continue;
+		io = ArrayAdd(ios);
+		if (io == NULL)
+			return -1;
+		io->issue_ns = rec.ts_ns - rec.lat_ns;
+		io->offset = rec.lba << 9;
+		io->len = rec.len;
+		io->op = rec.op;
+		io->origlat_ns = rec.lat_ns;
+	}
+	return 0;
+}
+
+// blkparse default output: "8,0 3 11 0.009507758 697 D W 223490 + 8 [kjournald]". dispatches (D) are
+// replayed, queue events (Q) only if the trace has no D, completions (C) give the original latency
+static int LoadBlkparse(FILE *f, r_array *ios) {
+	char line[512], action[8], rwbs[8];
+	unsigned maj, min, cpu, seq, pid, nsect;
+	uint64_t sector;
+	double sec;
+	r_array queued = {NULL, 0, 0, sizeof(replay_io)};
+	r_array comps = {NULL, 0, 0, sizeof(r_completion)};
+	r_array *dst;
+	replay_io *io;
+	r_completion *c;
+	uint64_t i;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%u,%u %u %u %lf %u %7s %7s %" SCNu64 " + %u", &maj, &min, &cpu, &seq, &sec, &pid, action, rwbs, &sector,
+				   &nsect) != 10)
+			continue;
+		if (strchr(rwbs, 'R') == NULL && strchr(rwbs, 'W') == NULL)
+			continue; // flush, discard
+		if (strcmp(action, "C") == 0) {
+			c = ArrayAdd(&comps);
+			if (c == NULL)
+				return -1;
+			c->sector = sector;
+			c->time_ns = (uint64_t)(sec * 1e9);
+			continue;
+		}
+		if (strcmp(action, "D") == 0)
+			dst = ios;
+		else if (strcmp(action, "Q") == 0)
+			dst = &queued;
+		else
+			continue;
+		if (nsect == 0)
+			continue;
+		io = ArrayAdd(dst);
+		if (io == NULL)
+			return -1;
+		io->issue_ns = (uint64_t)(sec * 1e9);
+		io->offset = sector << 9;
+		io->len = nsect << 9;
+		io->op = strchr(rwbs, 'W') != NULL ? io_op_write : io_op_read;
+		io->origlat_ns = 0;
+	}
+	if (ios->n == 0) {
+		free(ios->p);
+		*ios = queued;
+	} else {
+		free(queued.p);
+	}
+
+	qsort(comps.p, comps.n, sizeof(r_completion), cmp_completion);
+	for (i = 0; i < ios->n; i++) {
+		io = (replay_io *)ios->p + i;
+		io->origlat_ns = MatchCompletion(comps.p, comps.n, io->offset >> 9, io->issue_ns);
+	}
+	free(comps.p);
+	return 0;
+}
+
+// sorted by issue time, which starts at 0
+int LoadReplayTrace(const char *path, replay_io **ios, uint64_t *nios) {
+	FILE *f;
+	trace_header hdr;
+	r_array a = {NULL, 0, 0, sizeof(replay_io)};
+	uint64_t i, first;
+	int ret;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fopen failed");
+		return -1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) == 1 && memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0) {
+		if (hdr.version != TRACE_VERSION || hdr.recsize != sizeof(trace_record)) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "unsupported trace version");
+			fclose(f);
+			return -1;
+		}
+		ret = LoadBinary(f, &a);
+	} else {
+		rewind(f);
+		ret = LoadBlkparse(f, &a);
+	}
+	fclose(f);
+	if (ret != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc failed");
+		return -1;
+	}
+	if (a.n == 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "no read or write IO found in the trace");
+		return -1;
+	}
+
+	qsort(a.p, a.n, sizeof(replay_io), cmp_issue);
+	first = ((replay_io *)a.p)[0].issue_ns;
+	for (i = 0; i < a.n; i++)
+		((replay_io *)a.p)[i].issue_ns -= first;
+	*ios = a.p;
+	*nios = a.n;
+	return 0;
+}
+
+static void SleepNS(uint64_t ns) {
+	struct timespec t;
+	t.tv_sec = (time_t)(ns / 1000 / 1000 / 1000);
+	t.tv_nsec = (long)(ns % (1000 * 1000 * 1000));
+	nanosleep(&t, NULL);
+}
+
+int ReplayTrace(replay_params *params) {
+	int fd, i, n, timed;
+	ioengine e;
+	io_event ev[64];
+	replay_io *ios;
+	uint64_t nios, next, t, lss, maxlen, skipped, errors, late, maxlag_ns, lag, done, faster, now, start, due, elapsed_ns;
+	uint64_t *buf, *replat, *resplat;
+	histogram *hist, *resphist, *orighist, *ratiohist;
+	FILE *flog;
+	hms hms;
+
+	if (CheckIfBlockDevice(params->targetdrv) != 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "target is not a block device");
+		return -1;
+	}
+	if (getDriveSize(params->targetdrv, &t) != 0 || t < 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "getDriveSize failed");
+		return -1;
+	}
+	if (getLogicalSectorSize(params->targetdrv, &lss) != 0 || lss < 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "getLogicalSectorSize failed");
+		return -1;
+	}
+	if (LoadReplayTrace(params->tracepath, &ios, &nios) != 0)
+		return -1;
+
+	// IOs beyond this target, too large or not sector aligned (O_DIRECT would fail them) are left out
+	maxlen = 0;
+	skipped = 0;
+	for (next = 0; next < nios; next++) {
+		if (ios[next].offset + ios[next].len > t || ios[next].len > REPLAY_MAX_IOSIZE || ios[next].offset % lss != 0 ||
+			ios[next].len % lss != 0) {
+			ios[next].len = 0;
+			skipped++;
+		} else if (ios[next].len > maxlen) {
+			maxlen = ios[next].len;
+		}
+	}
+
+	replat = calloc(nios, sizeof(uint64_t));
+	resplat = calloc(nios, sizeof(uint64_t));
+	hist = malloc(sizeof(histogram));
+	resphist = malloc(sizeof(histogram));
+	orighist = malloc(sizeof(histogram));
+	ratiohist = malloc(sizeof(histogram));
+	if (replat == NULL || resplat == NULL || hist == NULL || resphist == NULL || orighist == NULL || ratiohist == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc failed");
+		return -1;
+	}
+	hist_init(hist);
+	hist_init(resphist);
+	hist_init(orighist);
+	hist_init(ratiohist);
+
+	// all requests share one buffer, its content doesn't matter
+	buf = iobuf_alloc(params->targetdrv, maxlen > 0 ? maxlen : 4096);
+	if (buf == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for buffer failed");
+		return -1;
+	}
+	pcg32_fill(buf, maxlen > 0 ? maxlen : 4096, ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid());
+
+	fd = open(params->targetdrv, O_RDWR | O_DIRECT);
+	if (fd == -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "open target failed");
+		return -1;
+	}
+	if (ioengine_init(&e, params->ioengine, fd, params->iodepth) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "ioengine_init failed");
+		return -1;
+	}
+
+	affinity_pin_io(0);
+	puts("Starting trace replay...");
+	timed = params->speed > 0;
+	next = 0;
+	done = skipped;
+	errors = 0;
+	late = 0;
+	maxlag_ns = 0;
+	start = getNowNS();
+	due = start;
+	while (done < nios) {
+		now = getNowNS();
+		while (next < nios) {
+			if (ios[next].len == 0) {
+				next++;
+				continue;
+			}
+			if (timed) {
+				due = start + (uint64_t)((double)ios[next].issue_ns / params->speed);
+				if (due > now)
+					break;
+			}
+			if (ioengine_queue_at(&e, (io_op)ios[next].op, buf, ios[next].len, ios[next].offset, next, timed ? due : 0) != 0)
+				break;
+			if (timed) {
+				lag = now - due;
+				if (lag > REPLAY_LATE_NS)
+					late++;
+				if (lag > maxlag_ns)
+					maxlag_ns = lag;
+			}
+			next++;
+		}
+		if (ioengine_submit(&e) < 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "submit failed");
+			return -1;
+		}
+		if (e.inflight == 0) {
+			if (timed && next < nios && due > now + REPLAY_SPIN_NS)
+				SleepNS(due - now - REPLAY_SPIN_NS);
+			continue;
+		}
+		// with free slots, don't block past the next issue time
+		n = ioengine_reap(&e, timed && next < nios && e.inflight < e.depth ? 0 : 1, ev, 64);
+		if (n < 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "reap failed");
+			return -1;
+		}
+		for (i = 0; i < n; i++) {
+			done++;
+			if (ev[i].res != (int64_t)ios[ev[i].tag].len) {
+				errors++;
+				continue;
+			}
+			replat[ev[i].tag] = ev[i].lat_ns;
+			resplat[ev[i].tag] = ev[i].resp_ns;
+			hist_record(hist, ev[i].lat_ns);
+			hist_record(resphist, ev[i].resp_ns);
+		}
+	}
+	elapsed_ns = getNowNS() - start;
+	ioengine_exit(&e);
+	close(fd);
+
+	// replayed / original, in 1/1000
+	faster = 0;
+	for (next = 0; next < nios; next++) {
+		if (ios[next].origlat_ns == 0 || replat[next] == 0)
+			continue;
+		hist_record(orighist, ios[next].origlat_ns);
+		hist_record(ratiohist, replat[next] * 1000 / ios[next].origlat_ns);
+		if (replat[next] < ios[next].origlat_ns)
+			faster++;
+	}
+
+	if (params->enablelogging) {
+		flog = fopen(params->logfilepath, "w");
+		if (flog == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fopen failed");
+			return -1;
+		}
+		fprintf(flog, "#Issue[us]\tOffset\tLength\tOp\tOriginal[us]\tReplayed[us]\tResponse[us]\n");
+		for (next = 0; next < nios; next++) {
+			if (ios[next].len == 0)
+				continue;
+			fprintf(flog, "%.1f\t%" PRIu64 "\t%u\t%c\t%.1f\t%.1f\t%.1f\n", (double)ios[next].issue_ns / 1000, ios[next].offset,
+					ios[next].len, ios[next].op == io_op_write ? 'W' : 'R', (double)ios[next].origlat_ns / 1000,
+					(double)replat[next] / 1000, (double)resplat[next] / 1000);
+		}
+		fclose(flog);
+	}
+
+	hms = getHMSfromMS(elapsed_ns / 1000 / 1000);
+	printf("Target               = %s\n", params->targetdrv);
+	printf("Trace                = %s\n", params->tracepath);
+	printf("Trace IOs            = %" PRIu64 " (%" PRIu64 " skipped, beyond the target, larger than %d or not %" PRIu64
+		   " B aligned)\n",
+		   nios, skipped, REPLAY_MAX_IOSIZE, lss);
+	printf("Trace Duration       = %.3f s\n", (double)ios[nios - 1].issue_ns / 1000 / 1000 / 1000);
+	printf("Replay Duration      = %d h %d m %d s (%.3f s)\n", hms.h, hms.m, hms.s, (double)elapsed_ns / 1000 / 1000 / 1000);
+	if (timed)
+		printf("Speed                = x%.2f\n", params->speed);
+	else
+		printf("Speed                = as fast as possible\n");
+	printf("IO Engine            = %s\n", ioengine_name(params->ioengine));
+	printf("IO Depth             = %d\n", params->iodepth);
+	printf("Errors               = %" PRIu64 "\n", errors);
+	if (timed) {
+		printf("Late IOs             = %" PRIu64 " (issued > %d ms after their time, all slots busy)\n", late, REPLAY_LATE_NS / 1000 / 1000);
+		printf("Max Issue Lag        = %.1f us\n", (double)maxlag_ns / 1000);
+	}
+	hist_print(hist, "Replayed latency");
+	if (timed)
+		hist_print(resphist, "Response latency");
+	if (orighist->count > 0) {
+		hist_print(orighist, "Original latency");
+		printf("Faster than original = %.1f %% of %" PRIu64 " IOs\n", (double)faster * 100 / orighist->count, orighist->count);
+		printf("Replayed/original p50: %.2f\n", (double)hist_percentile(ratiohist, 50) / 1000);
+		printf("Replayed/original p99: %.2f\n", (double)hist_percentile(ratiohist, 99) / 1000);
+	} else {
+		puts("Original latency     = not in the trace");
+	}
+
+	free(ios);
+	iobuf_free(buf, maxlen > 0 ? maxlen : 4096);
+	free(replat);
+	free(resplat);
+	free(hist);
+	free(resphist);
+	free(orighist);
+	free(ratiohist);
+	return errors > 0 ? -1 : 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ioengine.h"
+#include <stdint.h>
+
+#define REPLAY_MAX_IOSIZE (16 * 1024 * 1024)
+
+typedef struct {
+	uint64_t issue_ns; // from the first IO of the trace
+	uint64_t offset;
+	uint32_t len;
+	uint8_t op;			 // io_op
+	uint64_t origlat_ns; // 0: unknown
+} replay_io;
+
+typedef struct {
+	char *targetdrv;
+	char *tracepath; // blkparse text or a --trace file
+	double speed;	 // 1: original timing, 2: twice as fast, 0: as fast as possible
+	ioengine_type ioengine;
+	int iodepth;
+	int enablelogging;
+	char *logfilepath; // per IO original and replayed latency
+} replay_params;
+
+void init_replay_params(replay_params *params, char *targetdrv, char *tracepath, double speed, ioengine_type ioengine, int iodepth,
+						char *logfilepath);
+int LoadReplayTrace(const char *path, replay_io **ios, uint64_t *nios);
+int ReplayTrace(replay_params *params);
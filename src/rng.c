@@ -1,4 +1,18 @@
 #include "rng.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PCG_LANES 8
+#define FILL_MIN_CHUNK (16 * 1024 * 1024)
+#define FILL_MAX_THREADS 64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RNG_SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define RNG_SIMD_CLONES
+#endif
 
 uint32_t pcg32_random_r(pcg32_random_t *rng) {
 	uint64_t oldstate = rng->state;
@@ -47,3 +61,132 @@ uint64_t pcg32x2_boundedrand_r(pcg32x2_random_t *rng, uint64_t bound) {
 	}
 	return r % bound;
 }
+
+// counter-based pattern: every word is a pure function of (seed, lba, word index),
+// so the expected content of any sector can be regenerated without storing it
+static inline uint64_t splitmix64_mix(uint64_t z) {
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// fill len bytes of buf with the pattern of the sectors starting at byte position pos
+RNG_SIMD_CLONES
+static void lbapattern_fill_st(uint64_t *buf, uint64_t len, uint64_t pos, uint64_t sectorsize, uint64_t seed) {
+	uint64_t s, i, key;
+	uint64_t words = sectorsize / sizeof(uint64_t);
+	for (s = 0; s < len / sectorsize; s++) {
+		key = splitmix64_mix(seed ^ ((pos / sectorsize + s) * 0x9e3779b97f4a7c15ULL));
+		for (i = 0; i < words; i++)
+			buf[s * words + i] = splitmix64_mix(key + i * 0x9e3779b97f4a7c15ULL);
+	}
+}
+
+typedef uint64_t v_u64 __attribute__((vector_size(4 * sizeof(uint64_t))));
+typedef uint32_t v_u32 __attribute__((vector_size(4 * sizeof(uint32_t))));
+
+// one pcg32 step on 4 lanes, 4 x 32-bit output
+static inline v_u32 pcg32_step4(v_u64 *st, const v_u64 *inc) {
+	v_u64 old = *st;
+	v_u32 xorshifted, rot;
+	*st = old * 6364136223846793005ULL + *inc;
+	xorshifted = __builtin_convertvector(((old >> 18u) ^ old) >> 27u, v_u32);
+	rot = __builtin_convertvector(old >> 59u, v_u32);
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+// PCG_LANES independent pcg32 streams stepped together in SIMD registers, in groups of 4
+// so the multiplies of different groups overlap (avx2 clone is picked at runtime when available)
+RNG_SIMD_CLONES
+static void pcg32_lanes_fill(uint64_t *buf, uint64_t len, uint64_t seed, uint64_t stream) {
+	v_u64 st0, st1, inc0, inc1;
+	v_u32 out0, out1;
+	pcg32_random_t init;
+	uint64_t b, nblocks;
+	int l;
+
+	for (l = 0; l < PCG_LANES; l++) {
+		pcg32_srandom_r(&init, seed, stream * PCG_LANES + l);
+		if (l < 4) {
+			st0[l] = init.state;
+			inc0[l] = init.inc;
+		} else {
+			st1[l - 4] = init.state;
+			inc1[l - 4] = init.inc;
+		}
+	}
+	nblocks = len / (2 * sizeof(v_u32));
+	for (b = 0; b < nblocks; b++) {
+		out0 = pcg32_step4(&st0, &inc0);
+		out1 = pcg32_step4(&st1, &inc1);
+		memcpy((char *)buf + b * 2 * sizeof(v_u32), &out0, sizeof(v_u32));
+		memcpy((char *)buf + b * 2 * sizeof(v_u32) + sizeof(v_u32), &out1, sizeof(v_u32));
+	}
+	// tail shorter than one block
+	init.state = st0[0];
+	init.inc = inc0[0];
+	for (b = nblocks * 2 * sizeof(v_u32) / sizeof(uint64_t); b < len / sizeof(uint64_t); b++)
+		buf[b] = ((uint64_t)pcg32_random_r(&init) << 32) | pcg32_random_r(&init);
+}
+
+typedef struct {
+	uint64_t *buf;
+	uint64_t len;
+	uint64_t pos;
+	uint64_t sectorsize; // 0 for pcg32 fill
+	uint64_t seed;
+	uint64_t stream;
+} fill_job;
+
+static void *FillWorker(void *p) {
+	fill_job *job = p;
+	if (job->sectorsize == 0)
+		pcg32_lanes_fill(job->buf, job->len, job->seed, job->stream);
+	else
+		lbapattern_fill_st(job->buf, job->len, job->pos, job->sectorsize, job->seed);
+	return NULL;
+}
+
+// split buf into per-core chunks of whole units (8 bytes or one sector) and fill them in parallel
+static void ParallelFill(uint64_t *buf, uint64_t len, uint64_t pos, uint64_t sectorsize, uint64_t seed) {
+	fill_job jobs[FILL_MAX_THREADS];
+	pthread_t pth[FILL_MAX_THREADS];
+	int started[FILL_MAX_THREADS];
+	uint64_t unit = sectorsize != 0 ? sectorsize : sizeof(uint64_t);
+	uint64_t chunk, off;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, n;
+
+	n = ncpu > 0 ? (int)ncpu : 1;
+	if (n > FILL_MAX_THREADS)
+		n = FILL_MAX_THREADS;
+	if ((uint64_t)n > len / FILL_MIN_CHUNK)
+		n = (int)(len / FILL_MIN_CHUNK);
+	if (n < 1)
+		n = 1;
+	chunk = len / unit / n * unit;
+	off = 0;
+	for (i = 0; i < n; i++) {
+		jobs[i].buf = buf + off / sizeof(uint64_t);
+		jobs[i].len = i == n - 1 ? len - off : chunk;
+		jobs[i].pos = pos + off;
+		jobs[i].sectorsize = sectorsize;
+		jobs[i].seed = seed;
+		jobs[i].stream = (uint64_t)i;
+		off += jobs[i].len;
+		// run the last chunk on the calling thread, fall back to it if thread creation fails
+		started[i] = i < n - 1 && pthread_create(&pth[i], NULL, FillWorker, &jobs[i]) == 0;
+		if (!started[i])
+			FillWorker(&jobs[i]);
+	}
+	for (i = 0; i < n; i++)
+		if (started[i])
+			pthread_join(pth[i], NULL);
+}
+
+// fill len bytes (multiple of 8) with pcg32 output, vectorized and split across cores
+void pcg32_fill(uint64_t *buf, uint64_t len, uint64_t seed) { ParallelFill(buf, len, 0, 0, seed); }
+
+void lbapattern_fill(uint64_t *buf, uint64_t len, uint64_t pos, uint64_t sectorsize, uint64_t seed) {
+	ParallelFill(buf, len, pos, sectorsize, seed);
+}
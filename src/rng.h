@@ -17,3 +17,5 @@ void pcg32_srandom_r(pcg32_random_t *rng, uint64_t initstate, uint64_t initseq);
 void pcg32x2_srandom_r(pcg32x2_random_t *rng, uint64_t seed1, uint64_t seed2, uint64_t seq1, uint64_t seq2);
 uint64_t pcg32x2_random_r(pcg32x2_random_t *rng);
 uint64_t pcg32x2_boundedrand_r(pcg32x2_random_t *rng, uint64_t bound);
+void lbapattern_fill(uint64_t *buf, uint64_t len, uint64_t pos, uint64_t sectorsize, uint64_t seed);
+void pcg32_fill(uint64_t *buf, uint64_t len, uint64_t seed);
@@ -1,6 +1,11 @@
 #define _GNU_SOURCE
 #include "seq.h"
+#include "affinity.h"
 #include "drive.h"
+#include "drivetemp.h"
+#include "histogram.h"
+#include "ioengine.h"
+#include "iobuf.h"
 #include "rng.h"
 #include "tools.h"
 #include <errno.h>
@@ -18,17 +23,44 @@ typedef struct {
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	char *targetdrv;
+	drivetemp sensor;
 	int tinterval;
 	int curtemp;
 } tempmon_t;
 
-void init_seq_params(seq_params *p, char *drv, seq_rwmode mode, int tempmonitor_sec, char *logfilepath, int bufsize_MB, int calcsize) {
+typedef struct {
+	int id;
+	seq_params *params;
+	uint64_t start; // range of this stream
+	uint64_t end;
+	uint64_t t;
+	uint64_t *buf; // this stream's slice of the buffer
+	uint64_t bufsize;
+	uint64_t *windows; // sampled calcsize windows in ascending order, NULL for the whole range
+	int nwindows;
+	uint64_t bytes; // transferred
+	histogram hist;
+	FILE *flog;
+	pthread_mutex_t *print_mutex;
+	tempmon_t *tempmon;
+	atomic_int *abort; // a stream failed or couldn't start, the others stop at the next transfer
+	int ret;
+} s_stream;
+
+void init_seq_params(seq_params *p, char *drv, seq_rwmode mode, int tempmonitor_sec, char *logfilepath, int bufsize_MB, int calcsize,
+					 ioengine_type ioengine, int iodepth, int blocksize, int streams, int samples, int samplerandom) {
 	p->targetdrv = drv;
 	p->rwmode = mode;
+	p->ioengine = ioengine;
+	p->iodepth = iodepth;
 	p->tempmonitor_sec = tempmonitor_sec;
 	p->logfilepath = logfilepath;
 	p->bufsize_MB = bufsize_MB;
 	p->calcsize = calcsize;
+	p->blocksize = blocksize;
+	p->streams = streams;
+	p->samples = samples;
+	p->samplerandom = samplerandom;
 	if (logfilepath != NULL)
 		p->enablelogging = 1;
 	else
@@ -42,13 +74,14 @@ void init_seq_params(seq_params *p, char *drv, seq_rwmode mode, int tempmonitor_
 void *MonitorTemperature(void *p) {
 	struct timespec t;
 	tempmon_t *access = p;
+	affinity_pin_helper();
 	if (pthread_mutex_lock(&access->mutex) != 0) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex lock failed");
 		return NULL;
 	}
 	while (1) {
-		if (getDriveTemp(access->targetdrv, &access->curtemp) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "getDriveTemp failed");
+		if (drivetemp_read(&access->sensor, &access->curtemp) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "drivetemp_read failed");
 			return NULL;
 		}
 		clock_gettime(CLOCK_REALTIME, &t);
@@ -63,15 +96,159 @@ void *MonitorTemperature(void *p) {
 	return NULL;
 }
 
+// one row per calcsize, stream column only when there are several
+void PrintSeqRow(s_stream *s, uint64_t startpos, uint64_t bytes, uint64_t nsp) {
+	char col[16] = "";
+	if (s->params->streams > 1)
+		snprintf(col, sizeof(col), "%d\t", s->id);
+	pthread_mutex_lock(s->print_mutex);
+	printf("%s%" PRIu64 "\t%.4f\t%" PRIu64 "\t%.2f\t%" PRIu64 "\t%d\n", col, startpos, (double)startpos / s->t * 100, bytes,
+		   (double)bytes * 1000 / nsp, nsp / 1000 / 1000, atomic_load(&s->tempmon->curtemp));
+	if (s->flog != NULL) {
+		fprintf(s->flog, "%s%" PRIu64 "\t%.4f\t%" PRIu64 "\t%.2f\t%" PRIu64 "\t%d\n", col, startpos, (double)startpos / s->t * 100, bytes,
+				(double)bytes * 1000 / nsp, nsp / 1000 / 1000, atomic_load(&s->tempmon->curtemp));
+	}
+	pthread_mutex_unlock(s->print_mutex);
+}
+
+// transfer [start, end) printing a row at every calcsize boundary
+int SeqTransfer(s_stream *s, ioengine *e, uint64_t start, uint64_t end, uint64_t *ptr) {
+	uint64_t nsp, calcstartpoint, c, len, calcbytes;
+	struct timespec tspa, tspb;
+	io_op op = s->params->rwmode == seq_rwmode_w ? io_op_write : io_op_read;
+
+	calcbytes = (uint64_t)s->params->calcsize * 1024 * 1024;
+	calcstartpoint = start;
+	nsp = 0;
+	for (c = start; c < end;) {
+		if (atomic_load(s->abort))
+			return -1;
+		// transfer up to the next calcsize boundary, end of buffer or end of range
+		len = (c / calcbytes + 1) * calcbytes - c;
+		if (len > s->bufsize - *ptr * sizeof(uint64_t))
+			len = s->bufsize - *ptr * sizeof(uint64_t);
+		if (len > end - c)
+			len = end - c;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &tspa);
+		if (ioengine_transfer(e, op, &s->buf[*ptr], len, c, (uint64_t)s->params->blocksize, NULL, &s->hist) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "read/write error");
+			return -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &tspb);
+		nsp += getDiffNS(tspa, tspb);
+		*ptr += len / sizeof(uint64_t);
+		if (*ptr == s->bufsize / sizeof(uint64_t))
+			*ptr = 0;
+
+		c += len;
+		s->bytes += len;
+		if (c % calcbytes == 0 || c == end) {
+			PrintSeqRow(s, calcstartpoint, c - calcstartpoint, nsp);
+			calcstartpoint = c;
+			nsp = 0;
+		}
+	}
+	return 0;
+}
+
+int SeqLoop(s_stream *s) {
+	int fd, i, ret;
+	uint64_t ptr, calcbytes, start, end;
+	ioengine e;
+
+	// own fd, sync engine relies on the file offset
+	fd = open(s->params->targetdrv, O_RDWR | O_DIRECT);
+	if (fd == -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "open target failed");
+		return -1;
+	}
+	if (ioengine_init(&e, s->params->ioengine, fd, s->params->iodepth) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "ioengine_init failed");
+		close(fd);
+		return -1;
+	}
+
+	ptr = 0;
+	ret = 0;
+	if (s->windows == NULL) {
+		ret = SeqTransfer(s, &e, s->start, s->end, &ptr);
+	} else {
+		// each sampled window is exactly one row of a full scan
+		calcbytes = (uint64_t)s->params->calcsize * 1024 * 1024;
+		for (i = 0; i < s->nwindows && ret == 0; i++) {
+			start = s->windows[i] * calcbytes;
+			end = start + calcbytes > s->end ? s->end : start + calcbytes;
+			ret = SeqTransfer(s, &e, start, end, &ptr);
+		}
+	}
+
+	ioengine_exit(&e);
+	if (close(fd) == -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "close target failed");
+		return -1;
+	}
+	return ret;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// choose samples of nwindows calcsize windows, evenly spaced from first to last or at random, ascending
+uint64_t *PickSampleWindows(uint64_t nwindows, int samples, int samplerandom, int *n) {
+	uint64_t *w, i, j, tmp;
+	pcg32x2_random_t rng;
+
+	if ((uint64_t)samples > nwindows)
+		samples = (int)nwindows;
+	*n = samples;
+	if (samplerandom) {
+		// partial Fisher-Yates over all windows
+		w = malloc(sizeof(uint64_t) * nwindows);
+		if (w == NULL)
+			return NULL;
+		for (i = 0; i < nwindows; i++)
+			w[i] = i;
+		pcg32x2_srandom_r(&rng, time(NULL), (uint64_t)getpid(), 1, 2);
+		for (i = 0; i < (uint64_t)samples; i++) {
+			j = i + pcg32x2_boundedrand_r(&rng, nwindows - i);
+			tmp = w[i];
+			w[i] = w[j];
+			w[j] = tmp;
+		}
+		qsort(w, samples, sizeof(uint64_t), cmp_u64);
+	} else {
+		w = malloc(sizeof(uint64_t) * samples);
+		if (w == NULL)
+			return NULL;
+		for (i = 0; i < (uint64_t)samples; i++)
+			w[i] = samples > 1 ? i * (nwindows - 1) / (samples - 1) : 0;
+	}
+	return w;
+}
+
+void *SeqStream(void *p) {
+	s_stream *s = p;
+	affinity_pin_io(s->id);
+	s->ret = SeqLoop(s);
+	if (s->ret != 0)
+		atomic_store(s->abort, 1);
+	return NULL;
+}
+
 int SeqAccess(seq_params *params) {
-	int fd;
 	FILE *flog = NULL;
-	uint64_t *wbuf, *rbuf;
-	pcg32x2_random_t rng;
-	uint64_t t, ptr, nsp, mst, calcstartpoint, c, physicalsectorsize, buf_MB;
-	ssize_t retval;
-	struct timespec tsa, tsb, tspa, tspb;
+	uint64_t *wbuf, *rbuf, *buf;
+	uint64_t t, mst, c, physicalsectorsize, buf_MB, slicesize, rangesize, calcbytes;
+	uint64_t *windows;
+	int i, ret, nwindows, nstarted;
+	atomic_int abort;
+	struct timespec tsa, tsb;
 	pthread_t pth;
+	pthread_t *pth_streams;
+	pthread_mutex_t print_mutex;
+	s_stream *streams;
 	tempmon_t tempmon;
 	t = 0;
 	physicalsectorsize = 0;
@@ -95,10 +272,12 @@ int SeqAccess(seq_params *params) {
 		return -1;
 	}
 
-	// open target
-	fd = open(params->targetdrv, O_RDWR | O_DIRECT);
-	if (fd == -1) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "open target failed");
+	if ((uint64_t)params->blocksize % physicalsectorsize != 0 || (uint64_t)params->blocksize < physicalsectorsize) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "blocksize is not a multiple of physical sector size");
+		return -1;
+	}
+	if (params->streams < 1 || (uint64_t)params->streams > t / physicalsectorsize) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "wrong number of streams");
 		return -1;
 	}
 
@@ -108,22 +287,26 @@ int SeqAccess(seq_params *params) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "too small buffer size");
 		return -1;
 	}
+	// each stream gets its own slice of the buffer, a multiple of blocksize
+	slicesize = 1024 * 1024 * buf_MB / params->streams / params->blocksize * params->blocksize;
+	if (slicesize < (uint64_t)params->blocksize * params->iodepth) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "streams * iodepth * blocksize doesn't fit in buffer");
+		return -1;
+	}
 	if (params->rwmode == seq_rwmode_w) {
 		clock_gettime(CLOCK_MONOTONIC_RAW, &tsa);
-		if (posix_memalign((void **)&wbuf, 1024 * 1024, 1024 * 1024 * buf_MB) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "memalign for wbuf failed");
+		wbuf = iobuf_alloc(params->targetdrv, 1024 * 1024 * buf_MB);
+		if (wbuf == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for wbuf failed");
 			return -1;
 		}
-		pcg32x2_srandom_r(&rng, 42u, 42u, 54u, 54u);
-		pcg32x2_srandom_r(&rng, time(NULL), time(NULL), (intptr_t)&rng, (intptr_t)&rng);
-		for (ptr = 0; ptr < 1024 * 1024 * buf_MB / sizeof(uint64_t); ptr++) {
-			wbuf[ptr] = pcg32x2_random_r(&rng);
-		}
+		pcg32_fill(wbuf, 1024 * 1024 * buf_MB, ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid());
 		clock_gettime(CLOCK_MONOTONIC_RAW, &tsb);
 		printf("Preparation of Memory (Random %" PRIu64 " MB for write) - %" PRIu64 " ms\n", buf_MB, getDiffMS(tsa, tsb));
 	} else if (params->rwmode == seq_rwmode_r) {
-		if (posix_memalign((void **)&rbuf, 1024 * 1024, 1024 * 1024 * buf_MB) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "memalign for rbuf failed");
+		rbuf = iobuf_alloc(params->targetdrv, 1024 * 1024 * buf_MB);
+		if (rbuf == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for rbuf failed");
 			return -1;
 		}
 		memset(rbuf, '\0', 1024 * 1024 * buf_MB);
@@ -146,8 +329,10 @@ int SeqAccess(seq_params *params) {
 		puts("temp monitor enabled!!");
 		tempmon.targetdrv = params->targetdrv;
 		tempmon.tinterval = params->tempmonitor_sec;
-		if (getDriveTemp(tempmon.targetdrv, &tempmon.curtemp) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "getDriveTemp failed");
+		drivetemp_open(&tempmon.sensor, tempmon.targetdrv);
+		printf("Temperature Source   = %s\n", drivetemp_name(tempmon.sensor.src));
+		if (drivetemp_read(&tempmon.sensor, &tempmon.curtemp) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "drivetemp_read failed");
 		}
 		// create another thread for temperature monitoring, mutex lock required when accessing tempmon
 		pthread_mutex_init(&tempmon.mutex, NULL);
@@ -160,45 +345,77 @@ int SeqAccess(seq_params *params) {
 		tempmon.curtemp = -99;
 	}
 
+	// sampled scan accesses only some calcsize windows, a single stream
+	windows = NULL;
+	nwindows = 0;
+	if (params->samples > 0) {
+		calcbytes = (uint64_t)params->calcsize * 1024 * 1024;
+		windows = PickSampleWindows((t + calcbytes - 1) / calcbytes, params->samples, params->samplerandom, &nwindows);
+		if (windows == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc for sample windows failed");
+			return -1;
+		}
+	}
+
+	// each stream gets a range of the device, a multiple of physical sector size
+	streams = calloc(params->streams, sizeof(s_stream));
+	pth_streams = calloc(params->streams, sizeof(pthread_t));
+	if (streams == NULL || pth_streams == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "calloc for streams failed");
+		return -1;
+	}
+	pthread_mutex_init(&print_mutex, NULL);
+	atomic_init(&abort, 0);
+	buf = params->rwmode == seq_rwmode_w ? wbuf : rbuf;
+	rangesize = t / params->streams / physicalsectorsize * physicalsectorsize;
+	for (i = 0; i < params->streams; i++) {
+		streams[i].id = i;
+		streams[i].params = params;
+		streams[i].start = rangesize * i;
+		streams[i].end = i == params->streams - 1 ? t : rangesize * (i + 1);
+		streams[i].t = t;
+		streams[i].buf = &buf[slicesize * i / sizeof(uint64_t)];
+		streams[i].bufsize = slicesize;
+		streams[i].windows = windows;
+		streams[i].nwindows = nwindows;
+		streams[i].bytes = 0;
+		hist_init(&streams[i].hist);
+		streams[i].flog = flog;
+		streams[i].print_mutex = &print_mutex;
+		streams[i].tempmon = &tempmon;
+		streams[i].abort = &abort;
+		streams[i].ret = 0;
+	}
+
 	// fire!
 	puts("Start Seq Access...");
-	printf("StartPos\tPos[%%]\tBytesR/W\tSpeed[MB/s]\tTime[msec]\tTemperature[C]\n");
+	printf("%sStartPos\tPos[%%]\tBytesR/W\tSpeed[MB/s]\tTime[msec]\tTemperature[C]\n", params->streams > 1 ? "Stream\t" : "");
 	if (params->enablelogging) {
-		fprintf(flog, "#StartPos\tPos[%%]\tBytesR/W\tSpeed[MB/s]\tTime[msec]\tTemperature[C]\n");
+		fprintf(flog, "#%sStartPos\tPos[%%]\tBytesR/W\tSpeed[MB/s]\tTime[msec]\tTemperature[C]\n", params->streams > 1 ? "Stream\t" : "");
 	}
-	ptr = 0;
-	calcstartpoint = 0;
-	nsp = 0;
+	// on any failure every started stream is still joined and the monitor stopped, they use this frame
+	ret = 0;
 	clock_gettime(CLOCK_MONOTONIC_RAW, &tsa);
-	for (c = 0; c < t;) {
-		retval = 0;
-		clock_gettime(CLOCK_MONOTONIC_RAW, &tspa);
-		if (params->rwmode == seq_rwmode_w) {
-			retval = write(fd, &wbuf[ptr], 1024 * 1024);
-		} else if (params->rwmode == seq_rwmode_r) {
-			retval = read(fd, &rbuf[ptr], 1024 * 1024);
-		}
-		clock_gettime(CLOCK_MONOTONIC_RAW, &tspb);
-		nsp += getDiffNS(tspa, tspb);
-		if (retval == -1 || retval == 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "read/write error");
-			return -1;
+	for (nstarted = 0; nstarted < params->streams; nstarted++) {
+		if (pthread_create(&pth_streams[nstarted], NULL, SeqStream, &streams[nstarted]) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create stream thread failed");
+			atomic_store(&abort, 1);
+			ret = -1;
+			break;
 		}
-		ptr += retval / sizeof(uint64_t);
-		if (ptr == 1024 * 1024 * buf_MB / sizeof(uint64_t))
-			ptr = 0;
-
-		c += retval;
-		if (c / 1024 / 1024 % params->calcsize == 0 || c == t) {
-			printf("%" PRIu64 "\t%.4f\t%" PRIu64 "\t%.2f\t%" PRIu64 "\t%d\n", calcstartpoint, (double)calcstartpoint / t * 100,
-				   c - calcstartpoint, (double)(c - calcstartpoint) * 1000 / nsp, nsp / 1000 / 1000, atomic_load(&tempmon.curtemp));
-			if (params->enablelogging) {
-				fprintf(flog, "%" PRIu64 "\t%.4f\t%" PRIu64 "\t%.2f\t%" PRIu64 "\t%d\n", calcstartpoint, (double)calcstartpoint / t * 100,
-						c - calcstartpoint, (double)(c - calcstartpoint) * 1000 / nsp, nsp / 1000 / 1000, atomic_load(&tempmon.curtemp));
-			}
-			calcstartpoint = c;
-			nsp = 0;
+	}
+	c = 0;
+	for (i = 0; i < nstarted; i++) {
+		if (pthread_join(pth_streams[i], NULL) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
+			ret = -1;
+			continue;
 		}
+		if (streams[i].ret != 0)
+			ret = -1;
+		c += streams[i].bytes;
+		if (i > 0)
+			hist_merge(&streams[0].hist, &streams[i].hist);
 	}
 	clock_gettime(CLOCK_MONOTONIC_RAW, &tsb);
 	mst = getDiffMS(tsa, tsb);
@@ -221,21 +438,44 @@ int SeqAccess(seq_params *params) {
 			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
 			return -1;
 		}
+		drivetemp_close(&tempmon.sensor);
+	}
+	if (ret != 0) {
+		free(streams);
+		free(pth_streams);
+		if (windows != NULL)
+			free(windows);
+		if (params->rwmode == seq_rwmode_r)
+			iobuf_free(rbuf, 1024 * 1024 * buf_MB);
+		if (params->rwmode == seq_rwmode_w)
+			iobuf_free(wbuf, 1024 * 1024 * buf_MB);
+		if (params->enablelogging)
+			fclose(flog);
+		return -1;
 	}
 
 	printf("Target               = %s\n", params->targetdrv);
 	printf("Target Device Size   = %" PRIu64 "\n", t);
 	printf("Total RW Bytes       = %" PRIu64 "\n", c);
 	printf("Elapsed Time         = %d h %d m %d s\n", getHMSfromMS(mst).h, getHMSfromMS(mst).m, getHMSfromMS(mst).s);
-	printf("Average Throughput   = %.2f [MB/s]\n", (double)t / mst / 1000);
+	printf("Average Throughput   = %.2f [MB/s]\n", (double)c / mst / 1000);
+	printf("IO Engine            = %s\n", ioengine_name(params->ioengine));
+	printf("IO Depth             = %d\n", params->iodepth);
+	printf("Block Size           = %d\n", params->blocksize);
+	printf("Streams              = %d\n", params->streams);
+	if (params->samples > 0)
+		printf("Samples              = %d of %d MiB (%s)\n", nwindows, params->calcsize, params->samplerandom ? "random" : "evenly spaced");
+	hist_print(&streams[0].hist, "Latency");
 
 	// finalize
+	free(streams);
+	free(pth_streams);
+	if (windows != NULL)
+		free(windows);
 	if (params->rwmode == seq_rwmode_r)
-		if (rbuf != NULL)
-			free(rbuf);
+		iobuf_free(rbuf, 1024 * 1024 * buf_MB);
 	if (params->rwmode == seq_rwmode_w)
-		if (wbuf != NULL)
-			free(wbuf);
+		iobuf_free(wbuf, 1024 * 1024 * buf_MB);
 
 	if (params->enablelogging) {
 		if (fclose(flog) != 0) {
@@ -243,9 +483,5 @@ int SeqAccess(seq_params *params) {
 			return -1;
 		}
 	}
-	if (close(fd) == -1) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "close target failed");
-		return -1;
-	}
 	return 0;
 }
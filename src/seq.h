@@ -1,5 +1,7 @@
 #pragma once
 
+#include "ioengine.h"
+
 typedef enum { //
 	seq_rwmode_r,
 	seq_rwmode_w,
@@ -15,8 +17,14 @@ typedef struct {
 	char *logfilepath;
 	int enabletempmonitoring;
 	int tempmonitor_sec;
+	ioengine_type ioengine;
+	int iodepth;
+	int blocksize;
+	int streams; // device is split into this many ranges streamed concurrently
+	int samples; // 0: full scan, otherwise number of calcsize windows to access
+	int samplerandom; // pick windows randomly instead of evenly spaced
 } seq_params;
 
 void init_seq_params(seq_params *params, char *targetdrv, seq_rwmode mode, int tempmonitor_sec, char *logfilepath, int bufsize_MB,
-					 int calcsize);
+					 int calcsize, ioengine_type ioengine, int iodepth, int blocksize, int streams, int samples, int samplerandom);
 int SeqAccess(seq_params *params);
@@ -0,0 +1,109 @@
+#include "stamp.h"
+#include "crc32c.h"
+#include "rng.h"
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+// every sector checks on its own: a header naming the lba, run and generation it was written
+// for plus a crc32c over the sector (all but the crc field), so a region can be validated in a later run without
+// the written data and a failure tells what went wrong instead of only where
+
+static uint64_t PayloadSeed(uint64_t runid, uint64_t gen) { return runid ^ (gen * 0xd1b54a32d192ed03ULL); }
+
+static uint32_t SectorCRC(const uint64_t *sector, uint64_t sectorsize) {
+	uint32_t crc = crc32c(0, sector, offsetof(stamp_header, crc));
+	return crc32c(crc, (const char *)sector + sizeof(stamp_header), sectorsize - sizeof(stamp_header));
+}
+
+static void StampSectors(uint64_t *buf, uint64_t len, uint64_t pos, uint64_t sectorsize, uint64_t runid, uint64_t gen, uint64_t ts_ns) {
+	stamp_header *h;
+	uint64_t s;
+	lbapattern_fill(buf, len, pos, sectorsize, PayloadSeed(runid, gen));
+	for (s = 0; s < len / sectorsize; s++) {
+		h = (stamp_header *)&buf[s * sectorsize / sizeof(uint64_t)];
+		h->magic = STAMP_MAGIC;
+		h->lba = pos / sectorsize + s;
+		h->runid = runid;
+		h->gen = gen;
+		h->ts_ns = ts_ns;
+		h->sectorsize = (uint32_t)sectorsize;
+		h->crc = 0;
+		h->crc = SectorCRC((uint64_t *)h, sectorsize);
+	}
+}
+
+// fill len bytes of buf with the stamped sectors starting at byte position pos
+void stamp_fill(uint64_t *buf, uint64_t len, uint64_t pos, uint64_t sectorsize, uint64_t runid, uint64_t gen) {
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	StampSectors(buf, len, pos, sectorsize, runid, gen, (uint64_t)t.tv_sec * 1000 * 1000 * 1000 + (uint64_t)t.tv_nsec);
+}
+
+// classify one sector read from lba against the expected run and generation (gen 0: any).
+// found gets the sector's header as read, biterrors the flipped bits of a corrupt or torn sector
+// against what its header says was written. scratch holds one sector
+stamp_class stamp_check(const uint64_t *sector, uint64_t lba, uint64_t sectorsize, uint64_t runid, uint64_t gen, uint64_t *scratch,
+						stamp_header *found, uint64_t *biterrors) {
+	uint64_t i, words, block, good, replaced, other, bits;
+	int intact;
+
+	memcpy(found, sector, sizeof(stamp_header));
+	*biterrors = 0;
+	if (found->magic != STAMP_MAGIC)
+		return stamp_unwritten;
+	if (found->sectorsize == sectorsize && SectorCRC(sector, sectorsize) == found->crc) {
+		if (found->lba != lba)
+			return stamp_misdirected;
+		if (found->runid != runid)
+			return stamp_foreign;
+		if (gen != 0 && found->gen != gen)
+			return stamp_stale;
+		return stamp_ok;
+	}
+
+	// rebuild what should be there, from the header if it still belongs here
+	intact = found->lba == lba && found->runid == runid && found->sectorsize == sectorsize;
+	StampSectors(scratch, sectorsize, lba * sectorsize, sectorsize, runid, intact ? found->gen : (gen != 0 ? gen : 1),
+				 intact ? found->ts_ns : 0);
+	// torn: some blocks intact, the others replaced as a whole (by other data or zeros about half the
+	// bits differ) rather than a few flipped bits
+	words = sectorsize / sizeof(uint64_t);
+	good = 0;
+	replaced = 0;
+	other = 0;
+	for (block = 0; block < sectorsize / STAMP_BLOCK; block++) {
+		bits = 0;
+		for (i = block * STAMP_BLOCK / sizeof(uint64_t); i < (block + 1) * STAMP_BLOCK / sizeof(uint64_t) && i < words; i++)
+			bits += (uint64_t)__builtin_popcountll(scratch[i] ^ sector[i]);
+		*biterrors += bits;
+		if (bits == 0)
+			good++;
+		else if (bits >= STAMP_BLOCK * 8 / 4)
+			replaced++;
+		else
+			other++;
+	}
+	return good > 0 && replaced > 0 && other == 0 ? stamp_torn : stamp_corrupt;
+}
+
+const char *stamp_class_name(stamp_class c) {
+	switch (c) {
+		case stamp_ok:
+			return "ok";
+		case stamp_unwritten:
+			return "unwritten";
+		case stamp_corrupt:
+			return "corrupt";
+		case stamp_torn:
+			return "torn";
+		case stamp_misdirected:
+			return "misdirected";
+		case stamp_stale:
+			return "stale";
+		case stamp_foreign:
+			return "foreign";
+		default:
+			return "undefined";
+	}
+}
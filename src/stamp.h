@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#define STAMP_MAGIC 0x31504d4154535844ULL // "DXSTAMP1"
+#define STAMP_BLOCK 512					  // torn writes are told apart from corruption in units of this
+
+// first bytes of every physical sector of the stamp pattern, the rest is lba pattern keyed by run id and generation
+typedef struct {
+	uint64_t magic;
+	uint64_t lba; // physical sector number the stamp was written for
+	uint64_t runid;
+	uint64_t gen;	// pass / generation number
+	uint64_t ts_ns; // CLOCK_REALTIME when the chunk was stamped
+	uint32_t sectorsize;
+	uint32_t crc; // crc32c of the whole sector except this field
+} stamp_header;
+
+typedef enum { //
+	stamp_ok,
+	stamp_unwritten,   // no stamp at all: never written, lost or overwritten by something else
+	stamp_corrupt,	   // checksum fails
+	stamp_torn,		   // checksum fails, some STAMP_BLOCKs intact and the others replaced as a whole
+	stamp_misdirected, // valid stamp of another lba
+	stamp_stale,	   // valid stamp of this lba but another generation: the newer write never persisted
+	stamp_foreign,	   // valid stamp of this lba from another run
+	stamp_nclass
+} stamp_class;
+
+void stamp_fill(uint64_t *buf, uint64_t len, uint64_t pos, uint64_t sectorsize, uint64_t runid, uint64_t gen);
+stamp_class stamp_check(const uint64_t *sector, uint64_t lba, uint64_t sectorsize, uint64_t runid, uint64_t gen, uint64_t *scratch,
+						stamp_header *found, uint64_t *biterrors);
+const char *stamp_class_name(stamp_class c);
@@ -1,8 +1,12 @@
 #define _GNU_SOURCE
 #define _LARGEFILE64_SOURCE
 #include "sus_random.h"
+#include "affinity.h"
 #include "drive.h"
+#include "histogram.h"
 #include "rng.h"
+#include "ioengine.h"
+#include "iobuf.h"
 #include "tools.h"
 #include <errno.h>
 #include <fcntl.h>
@@ -15,20 +19,68 @@
 #include <time.h>
 #include <unistd.h>
 
+// per-worker IO counters, each on its own cache line so workers never contend
+typedef struct {
+	_Alignas(64) uint64_t numios_r;
+	uint64_t numios_w;
+	uint64_t bytes;
+} r_counter;
+
 typedef struct {
 	pthread_mutex_t log_mutex;
 	pthread_cond_t log_cond;
 	char *logfilepath;
 	uint64_t elapsed_ns;
-	uint64_t numios_r;
-	uint64_t numios_w;
+	r_counter *counters;
+	histogram *hists; // per-worker latency, single writer each
+	int numjobs;
+	int stop; // under log_mutex, a signal sent before CalculateIOPS waits would be lost
 } r_stat;
 
-void init_susrandom_params(susrandom_params *p, char *drv, susrandom_rwmode mode, int iosize, int duration, char *logfilepath) {
+typedef struct {
+	int id;
+	susrandom_params *params;
+	int fd;
+	uint64_t t;
+	uint64_t *wbuf; // this worker's slice of wbuf
+	uint64_t *rbuf; // this worker's slice of rbuf
+	uint64_t bufsize;
+	uint64_t rangestart;
+	uint64_t rangelen;
+	uint64_t seqpos; // next offset in sequential mode
+	dist_sampler *dist; // NULL for uniform
+	pcg32x2_random_t rng;
+	r_counter *counter;
+	histogram *hist;
+	histogram resphist; // open loop only
+	uint64_t late;
+	uint64_t maxlag_ns;
+	uint64_t cpu_user_us; // spent in RandomLoop
+	uint64_t cpu_sys_us;
+	uint64_t *remainsec;
+	int *abort;
+	int ret;
+} r_worker;
+
+void init_susrandom_params(susrandom_params *p, char *drv, susrandom_rwmode mode, int iosize, int duration, ioengine_type ioengine,
+						   int iodepth, int numjobs, char *logfilepath) {
 	p->targetdrv = drv;
 	p->rwmode = mode;
 	p->iosize = iosize;
 	p->durationsec = duration;
+	p->ioengine = ioengine;
+	p->iodepth = iodepth;
+	p->numjobs = numjobs;
+	p->readpct = mode == susr_rwmode_r ? 100 : mode == susr_rwmode_w ? 0 : 50;
+	p->nbs = 1;
+	p->bs[0] = iosize;
+	p->sequential = 0;
+	p->rangestart = 0;
+	p->rangelen = 0;
+	memset(&p->dist, 0, sizeof(dist_spec));
+	p->dist.type = dist_uniform;
+	p->rate_iops = 0;
+	p->rate_bw = 0;
 	p->logfilepath = logfilepath;
 	if (logfilepath != NULL) {
 		p->enablelogging = 1;
@@ -37,34 +89,78 @@ void init_susrandom_params(susrandom_params *p, char *drv, susrandom_rwmode mode
 	}
 }
 
+// RandomRun zeroes *sec to stop early, the count down never goes below that
 void *printRemainingTime(void *sec) {
-	uint64_t count = atomic_load((uint64_t *)sec);
+	uint64_t *remain = sec;
+	uint64_t count = atomic_load(remain);
+	affinity_pin_helper();
 	while (count > 0) {
-		printf("\r%02" PRIu64 " h %02" PRIu64 " m %02" PRIu64 " s remaining", count / 3600, count % 3600 / 60, count % 60);
+		if (!isQuietProgress())
+			printf("\r%02" PRIu64 " h %02" PRIu64 " m %02" PRIu64 " s remaining", count / 3600, count % 3600 / 60, count % 60);
 		sleep(1);
-		count--;
-		atomic_fetch_sub((int *)sec, 1);
+		if (atomic_compare_exchange_strong(remain, &count, count - 1))
+			count--;
 	}
-	printf("\r%02" PRIu64 " h %02" PRIu64 " m %02" PRIu64 " s remaining", count / 3600, count % 3600 / 60, count % 60);
-	printf("\nfinished.\n");
+	if (!isQuietProgress())
+		printf("\r%02" PRIu64 " h %02" PRIu64 " m %02" PRIu64 " s remaining\n", count / 3600, count % 3600 / 60, count % 60);
+	printf("finished.\n");
 	return NULL;
 }
 
+// only the owning worker writes its counter, so a relaxed store is enough
+static inline void CountIO(r_counter *c, int iswrite, uint64_t bytes) {
+	atomic_store_explicit(&c->bytes, c->bytes + bytes, memory_order_relaxed);
+	if (iswrite)
+		atomic_store_explicit(&c->numios_w, c->numios_w + 1, memory_order_relaxed);
+	else
+		atomic_store_explicit(&c->numios_r, c->numios_r + 1, memory_order_relaxed);
+}
+
+void SumCounters(r_stat *stat, uint64_t *numios_r, uint64_t *numios_w) {
+	int i;
+	*numios_r = 0;
+	*numios_w = 0;
+	for (i = 0; i < stat->numjobs; i++) {
+		*numios_r += atomic_load_explicit(&stat->counters[i].numios_r, memory_order_relaxed);
+		*numios_w += atomic_load_explicit(&stat->counters[i].numios_w, memory_order_relaxed);
+	}
+}
+
+uint64_t SumBytes(r_stat *stat) {
+	int i;
+	uint64_t bytes = 0;
+	for (i = 0; i < stat->numjobs; i++)
+		bytes += atomic_load_explicit(&stat->counters[i].bytes, memory_order_relaxed);
+	return bytes;
+}
+
 void *CalculateIOPS(void *p) {
-	int ret;
+	int i, ret;
 	FILE *flog;
+	histogram *now, *prev, *diff;
 	struct timespec t;
-	uint64_t temp_r, temp_w, ns;
+	uint64_t temp_r, temp_w, numios_r, numios_w, ns;
 	uint64_t elapsedsec = 0;
 	struct timespec tsa, tsb;
 	r_stat *stat = p;
 
+	affinity_pin_helper();
 	flog = fopen(stat->logfilepath, "w");
 	if (flog == NULL) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fopen failed");
 		return NULL;
 	}
-	fprintf(flog, "#Time[sec]\tIOs(R)\tIOs(W)\tIOs(R+W)\tIOPS(R)\tIOPS(W)\tIOPS(R+W)\n");
+	fprintf(flog, "#Time[sec]\tIOs(R)\tIOs(W)\tIOs(R+W)\tIOPS(R)\tIOPS(W)\tIOPS(R+W)\tp50[us]\tp99[us]\tp99.9[us]\tmax[us]\n");
+
+	// interval latency = difference between two snapshots of the cumulative histograms
+	now = malloc(sizeof(histogram));
+	prev = malloc(sizeof(histogram));
+	diff = malloc(sizeof(histogram));
+	if (now == NULL || prev == NULL || diff == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc for histogram failed");
+		return NULL;
+	}
+	hist_init(prev);
 
 	temp_r = 0;
 	temp_w = 0;
@@ -80,17 +176,28 @@ void *CalculateIOPS(void *p) {
 		clock_gettime(CLOCK_MONOTONIC_RAW, &tsb);
 		ns = getDiffNS(tsa, tsb);
 		if (ns > 500 * 1000 * 1000) {
-			fprintf(flog, "%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n", elapsedsec,
-					stat->numios_r, stat->numios_w, stat->numios_r + stat->numios_w, (stat->numios_r - temp_r) * 1000 * 1000 * 1000 / ns,
-					(stat->numios_w - temp_w) * 1000 * 1000 * 1000 / ns,
-					(stat->numios_r + stat->numios_w - temp_r - temp_w) * 1000 * 1000 * 1000 / ns);
-			temp_r = stat->numios_r;
-			temp_w = stat->numios_w;
+			SumCounters(stat, &numios_r, &numios_w);
+			hist_init(now);
+			for (i = 0; i < stat->numjobs; i++)
+				hist_merge(now, &stat->hists[i]);
+			hist_diff(diff, now, prev);
+			fprintf(flog,
+					"%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%.1f\t%.1f\t%.1f\t%.1f\n",
+					elapsedsec, numios_r, numios_w, numios_r + numios_w, (numios_r - temp_r) * 1000 * 1000 * 1000 / ns,
+					(numios_w - temp_w) * 1000 * 1000 * 1000 / ns, (numios_r + numios_w - temp_r - temp_w) * 1000 * 1000 * 1000 / ns,
+					(double)hist_percentile(diff, 50) / 1000, (double)hist_percentile(diff, 99) / 1000,
+					(double)hist_percentile(diff, 99.9) / 1000, (double)diff->max / 1000);
+			memcpy(prev, now, sizeof(histogram));
+			temp_r = numios_r;
+			temp_w = numios_w;
 			elapsedsec++;
 		}
-		if (ret != ETIMEDOUT)
+		if (ret != ETIMEDOUT || stat->stop)
 			break;
 	}
+	free(now);
+	free(prev);
+	free(diff);
 	if (fclose(flog) != 0) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fclose failed");
 	}
@@ -100,15 +207,381 @@ void *CalculateIOPS(void *p) {
 	return NULL;
 }
 
-int SustainedRandomAccess(susrandom_params *params) {
-	int fd;
-	uint64_t *wbuf, *rbuf;
-	pcg32x2_random_t rng;
-	uint64_t t, ptr, physicalsectorsize;
+// open loop: time between intended starts of this worker's IOs, the slower of both limits wins
+static inline double RateInterval(susrandom_params *params, uint64_t iosize) {
+	double iv = 0, bw;
+	if (params->rate_iops > 0)
+		iv = 1e9 * params->numjobs / params->rate_iops;
+	if (params->rate_bw > 0) {
+		bw = 1e9 * params->numjobs * iosize / params->rate_bw;
+		if (bw > iv)
+			iv = bw;
+	}
+	return iv;
+}
+
+#define SUSR_SPIN_NS (80 * 1000)
+
+static void SleepNS(uint64_t ns) {
+	struct timespec t;
+	t.tv_sec = (time_t)(ns / 1000 / 1000 / 1000);
+	t.tv_nsec = (long)(ns % (1000 * 1000 * 1000));
+	nanosleep(&t, NULL);
+}
+
+// keep params->iodepth requests in flight through the selected ioengine until remainsec reaches zero.
+// with a rate limit, IOs are due at fixed intended times instead (open loop) and those that can't be
+// queued on time because every slot is busy wait and are measured from their intended time
+int RandomLoop(r_worker *w) {
+	susrandom_params *params = w->params;
+	ioengine e;
+	io_event ev[64];
+	struct iovec iov[2];
+	unsigned nbuf;
+	uint64_t ptr, iosize, offset, now, lag;
+	double due;
+	int i, n, iswrite, stop, rated;
+
+	if (ioengine_init(&e, params->ioengine, w->fd, params->iodepth) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "ioengine_init failed");
+		return -1;
+	}
+	// register the worker's rbuf/wbuf slice, each request uses its own part of it
+	nbuf = 0;
+	if (w->rbuf != NULL) {
+		iov[nbuf].iov_base = w->rbuf;
+		iov[nbuf].iov_len = w->bufsize;
+		nbuf++;
+	}
+	if (w->wbuf != NULL) {
+		iov[nbuf].iov_base = w->wbuf;
+		iov[nbuf].iov_len = w->bufsize;
+		nbuf++;
+	}
+	if (ioengine_register_buffers(&e, iov, nbuf) != 0 && w->id == 0)
+		puts("buffer registration failed (RLIMIT_MEMLOCK?), fall back to unregistered buffers");
+
+	ptr = 0;
+	stop = 0;
+	rated = params->rate_iops > 0 || params->rate_bw > 0;
+	now = getNowNS();
+	due = (double)now + RateInterval(params, params->iosize) * w->id / params->numjobs; // workers interleave
+	while (1) {
+		if (atomic_load(w->remainsec) == 0 || atomic_load(w->abort))
+			stop = 1;
+		if (rated)
+			now = getNowNS();
+		while (!stop) {
+			if (rated && due > (double)now)
+				break;
+			if (params->readpct >= 100)
+				iswrite = 0;
+			else if (params->readpct <= 0)
+				iswrite = 1;
+			else
+				iswrite = (int)pcg32x2_boundedrand_r(&w->rng, 100) >= params->readpct;
+			iosize = params->nbs > 1 ? (uint64_t)params->bs[alias_pick(&params->bsalias, pcg32x2_random_r(&w->rng))] : (uint64_t)params->iosize;
+			if (params->sequential) {
+				if (w->seqpos + iosize > w->rangestart + w->rangelen)
+					w->seqpos = w->rangestart;
+				offset = w->seqpos;
+			} else if (w->dist != NULL) {
+				offset = w->rangestart + dist_next(w->dist, &w->rng) * params->iosize;
+			} else {
+				offset = w->rangestart + pcg32x2_boundedrand_r(&w->rng, w->rangelen / iosize) * iosize;
+			}
+			if ((ptr * sizeof(uint64_t)) + iosize > w->bufsize)
+				ptr = 0;
+			// tag carries size and direction for the completion check
+			if (ioengine_queue_at(&e, iswrite ? io_op_write : io_op_read, iswrite ? &w->wbuf[ptr] : &w->rbuf[ptr], iosize, offset,
+								  iosize << 1 | (uint64_t)iswrite, rated ? (uint64_t)due : 0) != 0)
+				break;
+			if (rated) {
+				lag = now - (uint64_t)due;
+				if (lag > SUSR_LATE_NS)
+					w->late++;
+				if (lag > w->maxlag_ns)
+					w->maxlag_ns = lag;
+				due += RateInterval(params, iosize);
+			}
+			if (params->sequential)
+				w->seqpos += iosize;
+			ptr += iosize / sizeof(uint64_t);
+			if (ptr == w->bufsize / sizeof(uint64_t))
+				ptr = 0;
+		}
+		if (ioengine_submit(&e) < 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "submit failed");
+			ioengine_exit(&e);
+			return -1;
+		}
+		if (e.inflight == 0) {
+			if (stop)
+				break;
+			if (rated && due > (double)now + SUSR_SPIN_NS)
+				SleepNS((uint64_t)due - now - SUSR_SPIN_NS);
+			continue;
+		}
+		// open loop with free slots must not block past the next due time
+		n = ioengine_reap(&e, rated && e.inflight < e.depth ? 0 : 1, ev, 64);
+		if (n < 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "reap failed");
+			ioengine_exit(&e);
+			return -1;
+		}
+		for (i = 0; i < n; i++) {
+			if (ev[i].res != (int64_t)(ev[i].tag >> 1)) {
+				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, ev[i].tag & 1 ? "write error" : "read error");
+				ioengine_exit(&e);
+				return -1;
+			}
+			hist_record(w->hist, ev[i].lat_ns);
+			if (rated)
+				hist_record(&w->resphist, ev[i].resp_ns);
+			CountIO(w->counter, (int)(ev[i].tag & 1), ev[i].tag >> 1);
+		}
+		if (rated && n == 0 && !stop) {
+			// poll completions meanwhile, spin over the last stretch since sleeps overshoot
+			now = getNowNS();
+			if (due > (double)now + SUSR_SPIN_NS)
+				SleepNS((uint64_t)due - now - SUSR_SPIN_NS < 20 * 1000 ? (uint64_t)due - now - SUSR_SPIN_NS : 20 * 1000);
+		}
+	}
+
+	ioengine_exit(&e);
+	return 0;
+}
+
+void *RandomWorker(void *p) {
+	r_worker *w = p;
+	uint64_t user_us, sys_us;
+	affinity_pin_io(w->id);
+	getThreadCPUUS(&user_us, &sys_us);
+	w->ret = RandomLoop(w);
+	getThreadCPUUS(&w->cpu_user_us, &w->cpu_sys_us);
+	w->cpu_user_us -= user_us;
+	w->cpu_sys_us -= sys_us;
+	if (w->ret != 0)
+		atomic_store(w->abort, 1);
+	return NULL;
+}
+
+// run params->numjobs workers on an opened target for params->durationsec, wbuf/rbuf are shared by all
+// workers and may be NULL when not needed by readpct
+int RandomRun(susrandom_params *params, int fd, uint64_t t, uint64_t *wbuf, uint64_t *rbuf, uint64_t bufsize, susrandom_result *res) {
+	uint64_t slicesize, rangestart, rangelen;
 	struct timespec tsa, tsb;
 	pthread_t pth_remain, pth_log;
+	pthread_t *pth_workers;
+	r_worker *workers;
 	r_stat stat;
+	dist_sampler dist;
 	uint64_t remainsec;
+	int i, abort, ret, nstarted, logstarted, remainstarted;
+
+	if (params->numjobs < 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "wrong numjobs");
+		return -1;
+	}
+	// each worker gets its own slice of the buffer, a multiple of iosize
+	slicesize = bufsize / params->numjobs / params->iosize * params->iosize;
+	if (slicesize < (uint64_t)params->iosize * params->iodepth) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "numjobs * iodepth * iosize doesn't fit in buffer");
+		return -1;
+	}
+
+	rangestart = params->rangestart;
+	rangelen = params->rangelen != 0 ? params->rangelen : t - rangestart;
+	if (rangestart + rangelen > t || rangelen < (uint64_t)params->iosize) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "LBA range is out of the device or smaller than iosize");
+		return -1;
+	}
+
+	remainsec = (uint64_t)params->durationsec;
+	if (remainsec < 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "wrong duration");
+		return -1;
+	}
+
+	// skewed offsets share one read-only sampler, picks are in units of the largest iosize
+	if (params->dist.type != dist_uniform && dist_init(&dist, &params->dist, rangelen / params->iosize) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "dist_init failed");
+		return -1;
+	}
+
+	// prepare workers, each with its own rng stream, buffer slice and counter
+	ret = -1;
+	nstarted = 0;
+	logstarted = 0;
+	remainstarted = 0;
+	stat.counters = NULL;
+	stat.hists = NULL;
+	workers = calloc(params->numjobs, sizeof(r_worker));
+	pth_workers = calloc(params->numjobs, sizeof(pthread_t));
+	if (workers == NULL || pth_workers == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "calloc for workers failed");
+		goto out;
+	}
+	if (posix_memalign((void **)&stat.counters, 64, sizeof(r_counter) * params->numjobs) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "memalign for counters failed");
+		stat.counters = NULL;
+		goto out;
+	}
+	memset(stat.counters, 0, sizeof(r_counter) * params->numjobs);
+	stat.hists = malloc(sizeof(histogram) * params->numjobs);
+	if (stat.hists == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc for histograms failed");
+		goto out;
+	}
+	stat.numjobs = params->numjobs;
+	abort = 0;
+	for (i = 0; i < params->numjobs; i++) {
+		workers[i].id = i;
+		workers[i].params = params;
+		workers[i].fd = fd;
+		workers[i].t = t;
+		workers[i].wbuf = wbuf != NULL ? &wbuf[slicesize * i / sizeof(uint64_t)] : NULL;
+		workers[i].rbuf = rbuf != NULL ? &rbuf[slicesize * i / sizeof(uint64_t)] : NULL;
+		workers[i].bufsize = slicesize;
+		workers[i].rangestart = rangestart;
+		workers[i].rangelen = rangelen;
+		// sequential workers start evenly spread over the range
+		workers[i].dist = params->dist.type != dist_uniform ? &dist : NULL;
+		workers[i].seqpos = rangestart + rangelen / params->numjobs * i / params->iosize * params->iosize;
+		pcg32x2_srandom_r(&workers[i].rng, time(NULL) + i, time(NULL) - i, (uint64_t)i * 2, (uint64_t)i * 2 + 1);
+		workers[i].counter = &stat.counters[i];
+		workers[i].hist = &stat.hists[i];
+		hist_init(workers[i].hist);
+		hist_init(&workers[i].resphist);
+		workers[i].late = 0;
+		workers[i].maxlag_ns = 0;
+		workers[i].remainsec = &remainsec;
+		workers[i].abort = &abort;
+		workers[i].ret = 0;
+	}
+
+	// if logging enabled
+	if (params->enablelogging) {
+		// create another thread for count down, mutex lock required when accessing stat
+		stat.logfilepath = params->logfilepath;
+		pthread_mutex_init(&stat.log_mutex, NULL);
+		pthread_cond_init(&stat.log_cond, NULL);
+		stat.stop = 0;
+		if (pthread_create(&pth_log, NULL, CalculateIOPS, &stat) != 0)
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
+		else
+			logstarted = 1;
+	}
+
+	// create another thread for count down, mutex lock required when accessing remainsec
+	if (pthread_create(&pth_remain, NULL, printRemainingTime, &remainsec) != 0)
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
+	else
+		remainstarted = 1;
+
+	ret = 0;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &tsa);
+	for (i = 0; i < params->numjobs; i++) {
+		if (pthread_create(&pth_workers[i], NULL, RandomWorker, &workers[i]) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create worker thread failed");
+			atomic_store(&abort, 1);
+			ret = -1;
+			break;
+		}
+		nstarted++;
+	}
+	for (i = 0; i < nstarted; i++) {
+		if (pthread_join(pth_workers[i], NULL) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
+			ret = -1;
+		}
+		if (workers[i].ret != 0)
+			ret = -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC_RAW, &tsb);
+
+	// the helpers use stat and remainsec on this stack, they are stopped and joined even on failure
+	atomic_store(&remainsec, 0);
+	if (logstarted) {
+		pthread_mutex_lock(&stat.log_mutex);
+		stat.stop = 1;
+		pthread_cond_signal(&stat.log_cond);
+		pthread_mutex_unlock(&stat.log_mutex);
+		if (pthread_join(pth_log, NULL) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
+			ret = -1;
+		}
+	}
+	if (remainstarted && pthread_join(pth_remain, NULL) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
+		ret = -1;
+	}
+	if (ret != 0)
+		goto out;
+
+	SumCounters(&stat, &res->numios_r, &res->numios_w);
+	res->bytes = SumBytes(&stat);
+	res->elapsed_ms = getDiffMS(tsa, tsb);
+	hist_init(&res->hist);
+	hist_init(&res->resphist);
+	res->late = 0;
+	res->maxlag_ns = 0;
+	res->cpu_user_us = 0;
+	res->cpu_sys_us = 0;
+	for (i = 0; i < params->numjobs; i++) {
+		hist_merge(&res->hist, &stat.hists[i]);
+		hist_merge(&res->resphist, &workers[i].resphist);
+		res->late += workers[i].late;
+		res->cpu_user_us += workers[i].cpu_user_us;
+		res->cpu_sys_us += workers[i].cpu_sys_us;
+		if (workers[i].maxlag_ns > res->maxlag_ns)
+			res->maxlag_ns = workers[i].maxlag_ns;
+	}
+	if (params->rate_iops == 0 && params->rate_bw == 0)
+		memcpy(&res->resphist, &res->hist, sizeof(histogram));
+
+out:
+	free(workers);
+	free(pth_workers);
+	free(stat.counters);
+	free(stat.hists);
+	if (params->dist.type != dist_uniform)
+		dist_free(&dist);
+	return ret;
+}
+
+// open loop summary, response is what a client arriving on schedule would see
+void PrintRateResult(susrandom_params *params, susrandom_result *res) {
+	if (params->rate_iops == 0 && params->rate_bw == 0)
+		return;
+	if (params->rate_iops > 0)
+		printf("Rate Limit   : %" PRIu64 " IOPS\n", params->rate_iops);
+	if (params->rate_bw > 0)
+		printf("Rate Limit   : %.2f MB/s\n", (double)params->rate_bw / 1000 / 1000);
+	printf("Late IOs     : %" PRIu64 " (%.2f %%, > %d us behind schedule)\n", res->late,
+		   res->numios_r + res->numios_w > 0 ? (double)res->late * 100 / (res->numios_r + res->numios_w) : 0.0, SUSR_LATE_NS / 1000);
+	printf("Max Lag      : %.1f us\n", (double)res->maxlag_ns / 1000);
+	hist_print(&res->resphist, "Response");
+}
+
+// cpu time of the IO workers, polling (--hipri) trades it for latency. 100 % is one cpu busy for the whole run
+void PrintCPUResult(susrandom_result *res) {
+	uint64_t numios = res->numios_r + res->numios_w;
+	unsigned flags = ioengine_get_flags();
+	if (flags != 0)
+		printf("IO Polling   : %s%s%s\n", flags & IOENGINE_HIPRI ? "hipri" : "", flags == (IOENGINE_HIPRI | IOENGINE_SQPOLL) ? ", " : "",
+			   flags & IOENGINE_SQPOLL ? "sqpoll (its kernel thread is not counted below)" : "");
+	printf("CPU Usage    : %.1f %% (usr %.1f %%, sys %.1f %%)\n", (double)(res->cpu_user_us + res->cpu_sys_us) / 10 / res->elapsed_ms,
+		   (double)res->cpu_user_us / 10 / res->elapsed_ms, (double)res->cpu_sys_us / 10 / res->elapsed_ms);
+	printf("CPU per IO   : %.2f us\n", numios > 0 ? (double)(res->cpu_user_us + res->cpu_sys_us) / numios : 0.0);
+}
+
+int SustainedRandomAccess(susrandom_params *params) {
+	int fd;
+	uint64_t *wbuf, *rbuf;
+	uint64_t t, physicalsectorsize;
+	susrandom_result res;
+	char distname[256];
 	int buf_MB = 256;
 
 	t = 0;
@@ -143,12 +616,6 @@ int SustainedRandomAccess(susrandom_params *params) {
 		}
 	}
 
-	remainsec = (uint64_t)params->durationsec;
-	if (remainsec < 1) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "wrong duration");
-		return -1;
-	}
-
 	// open target
 	fd = open(params->targetdrv, O_RDWR | O_DIRECT);
 	if (fd == -1) {
@@ -158,143 +625,47 @@ int SustainedRandomAccess(susrandom_params *params) {
 
 	// prepare buffer
 	if (params->rwmode == susr_rwmode_w || params->rwmode == susr_rwmode_rw) {
-		if (posix_memalign((void **)&wbuf, 1024 * 1024, 1024 * 1024 * buf_MB) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "memalign for wbuf failed");
+		wbuf = iobuf_alloc(params->targetdrv, 1024 * 1024 * buf_MB);
+		if (wbuf == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for wbuf failed");
 			return -1;
 		}
-		pcg32x2_srandom_r(&rng, 42u, 42u, 54u, 54u);
-		pcg32x2_srandom_r(&rng, time(NULL), time(NULL), (intptr_t)&rng, (intptr_t)&rng);
-		for (ptr = 0; ptr < 1024 * 1024 * buf_MB / sizeof(uint64_t); ptr++) {
-			wbuf[ptr] = pcg32x2_random_r(&rng);
-		}
+		pcg32_fill(wbuf, 1024 * 1024 * buf_MB, ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid());
 	}
 	if (params->rwmode == susr_rwmode_r || params->rwmode == susr_rwmode_rw) {
-		if (posix_memalign((void **)&rbuf, 1024 * 1024, 1024 * 1024 * buf_MB) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "memalign for rbuf failed");
+		rbuf = iobuf_alloc(params->targetdrv, 1024 * 1024 * buf_MB);
+		if (rbuf == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for rbuf failed");
 			return -1;
 		}
 		memset(rbuf, '\0', 1024 * 1024 * buf_MB);
 	}
 
-	// if logging enabled
-	if (params->enablelogging) {
-		// create another thread for count down, mutex lock required when accessing stat
-		stat.logfilepath = params->logfilepath;
-		pthread_mutex_init(&stat.log_mutex, NULL);
-		pthread_cond_init(&stat.log_cond, NULL);
-		if (pthread_create(&pth_log, NULL, CalculateIOPS, &stat) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
-		}
-	}
-
 	// fire!
 	puts("Starting sustained random access...");
-	stat.numios_r = 0;
-	stat.numios_w = 0;
-
-	// create another thread for count down, mutex lock required when accessing remainsec
-	if (pthread_create(&pth_remain, NULL, printRemainingTime, &remainsec) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
-	}
-
-	clock_gettime(CLOCK_MONOTONIC_RAW, &tsa);
-	ptr = 0;
-	if (params->rwmode == susr_rwmode_r) {
-		while (1) {
-			if (pread(fd, &rbuf[ptr], params->iosize, pcg32x2_boundedrand_r(&rng, t / params->iosize) * params->iosize) == -1) {
-				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "read error");
-				return -1;
-			}
-			ptr += params->iosize / sizeof(uint64_t);
-			if (ptr == 1024 * 1024 * buf_MB / sizeof(uint64_t))
-				ptr = 0;
-			atomic_fetch_add(&stat.numios_r, 1);
-			if (atomic_load(&remainsec) == 0)
-				break;
-		}
-	} else if (params->rwmode == susr_rwmode_w) {
-		while (1) {
-			if (pwrite(fd, &wbuf[ptr], params->iosize, pcg32x2_boundedrand_r(&rng, t / params->iosize) * params->iosize) == -1) {
-				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "write error");
-				return -1;
-			}
-			ptr += params->iosize / sizeof(uint64_t);
-			if (ptr == 1024 * 1024 * buf_MB / sizeof(uint64_t))
-				ptr = 0;
-			atomic_fetch_add(&stat.numios_w, 1);
-			if (atomic_load(&remainsec) == 0)
-				break;
-		}
-	} else if (params->rwmode == susr_rwmode_rw) {
-		while (1) {
-			if (pcg32x2_boundedrand_r(&rng, 2)) { // read
-				if (pread(fd, &rbuf[ptr], params->iosize, pcg32x2_boundedrand_r(&rng, t / params->iosize) * params->iosize) == -1) {
-					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "read error");
-					return -1;
-				}
-				ptr += params->iosize / sizeof(uint64_t);
-				if (ptr == 1024 * 1024 * buf_MB / sizeof(uint64_t))
-					ptr = 0;
-				atomic_fetch_add(&stat.numios_r, 1);
-			} else { // write
-				if (pwrite(fd, &wbuf[ptr], params->iosize, pcg32x2_boundedrand_r(&rng, t / params->iosize) * params->iosize) == -1) {
-					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "write error");
-					return -1;
-				}
-				ptr += params->iosize / sizeof(uint64_t);
-				if (ptr == 1024 * 1024 * buf_MB / sizeof(uint64_t))
-					ptr = 0;
-				atomic_fetch_add(&stat.numios_w, 1);
-			}
-			if (atomic_load(&remainsec) == 0)
-				break;
-		}
-	} else {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "undefined access mode");
-		return -1;
-	}
-	clock_gettime(CLOCK_MONOTONIC_RAW, &tsb);
-
-	// stop logging thread
-	if (params->enablelogging) {
-		if (pthread_mutex_lock(&stat.log_mutex) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex lock failed");
-			return -1;
-		}
-		if (pthread_cond_signal(&stat.log_cond) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "signaling failed");
-			return -1;
-		}
-		if (pthread_mutex_unlock(&stat.log_mutex) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex unlock failed");
-			return -1;
-		}
-		if (pthread_join(pth_log, NULL) != 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
-			return -1;
-		}
-	}
-
-	// work finished, stop count down thread
-	if (pthread_join(pth_remain, NULL) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
+	if (RandomRun(params, fd, t, wbuf, rbuf, (uint64_t)1024 * 1024 * buf_MB, &res) != 0)
 		return -1;
-	}
 
 	// show statistical result
 	printf("Target       : %s\n", params->targetdrv);
-	printf("Total IOs(R) : %" PRIu64 "\n", stat.numios_r);
-	printf("Total IOs(W) : %" PRIu64 "\n", stat.numios_w);
-	printf("IOPS         : %" PRIu64 "\n", (stat.numios_r + stat.numios_w) * 1000 / getDiffMS(tsa, tsb));
-	printf("Throughput   : %.2f MB/s\n", (double)(stat.numios_r + stat.numios_w) * params->iosize / getDiffMS(tsa, tsb) / 1000);
+	printf("Total IOs(R) : %" PRIu64 "\n", res.numios_r);
+	printf("Total IOs(W) : %" PRIu64 "\n", res.numios_w);
+	printf("IO Engine    : %s\n", ioengine_name(params->ioengine));
+	printf("IO Depth     : %d\n", params->iodepth);
+	printf("Num Jobs     : %d\n", params->numjobs);
+	dist_name(&params->dist, distname, sizeof(distname));
+	printf("Distribution : %s\n", distname);
+	printf("IOPS         : %" PRIu64 "\n", (res.numios_r + res.numios_w) * 1000 / res.elapsed_ms);
+	printf("Throughput   : %.2f MB/s\n", (double)res.bytes / res.elapsed_ms / 1000);
+	PrintRateResult(params, &res);
+	PrintCPUResult(&res);
+	hist_print(&res.hist, "Latency");
 
 	// finalize
 	if (params->rwmode == susr_rwmode_w || params->rwmode == susr_rwmode_rw)
-		if (wbuf != NULL)
-			free(wbuf);
+		iobuf_free(wbuf, 1024 * 1024 * buf_MB);
 	if (params->rwmode == susr_rwmode_r || params->rwmode == susr_rwmode_rw)
-		if (rbuf != NULL)
-			free(rbuf);
+		iobuf_free(rbuf, 1024 * 1024 * buf_MB);
 	if (close(fd) == -1) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "close target failed");
 		return -1;
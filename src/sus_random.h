@@ -1,5 +1,10 @@
 #pragma once
 
+#include "alias.h"
+#include "dist.h"
+#include "histogram.h"
+#include "ioengine.h"
+
 typedef enum { //
 	susr_rwmode_r,
 	susr_rwmode_w,
@@ -7,14 +12,47 @@ typedef enum { //
 	susr_rwmode_undefined
 } susrandom_rwmode;
 
+#define SUSR_MAX_BS 16
+#define SUSR_LATE_NS (1000 * 1000)
+
 typedef struct {
 	char *targetdrv;
 	susrandom_rwmode rwmode;
-	int iosize;
+	int iosize; // largest one if several
 	int durationsec;
+	ioengine_type ioengine;
+	int iodepth;
+	int numjobs;
+	int readpct; // share of reads in percent, follows rwmode (rw: 50)
+	int nbs;	 // > 1: size of each IO is picked from bs[] through bsalias
+	int bs[SUSR_MAX_BS];
+	alias_table bsalias;
+	int sequential;		 // each worker walks its part of the range instead of random offsets
+	uint64_t rangestart; // target LBA range in bytes, rangelen 0 = whole device
+	uint64_t rangelen;
+	dist_spec dist; // offsets of random access, in units of iosize
+	uint64_t rate_iops; // open loop when either is > 0, total over workers
+	uint64_t rate_bw;	// bytes per second
 	int enablelogging;
 	char *logfilepath;
 } susrandom_params;
 
-void init_susrandom_params(susrandom_params *params, char *targetdrv, susrandom_rwmode mode, int iosize, int duration, char *logfilepath);
+typedef struct {
+	uint64_t numios_r;
+	uint64_t numios_w;
+	uint64_t bytes;
+	uint64_t elapsed_ms;
+	uint64_t late;		  // open loop: IOs queued more than SUSR_LATE_NS after their intended start
+	uint64_t maxlag_ns;	  // open loop: worst queueing delay behind the schedule
+	uint64_t cpu_user_us; // summed over workers
+	uint64_t cpu_sys_us;
+	histogram hist;		  // merged over workers, from submit
+	histogram resphist;	  // from intended start, same as hist in closed loop
+} susrandom_result;
+
+void init_susrandom_params(susrandom_params *params, char *targetdrv, susrandom_rwmode mode, int iosize, int duration,
+						   ioengine_type ioengine, int iodepth, int numjobs, char *logfilepath);
+int RandomRun(susrandom_params *params, int fd, uint64_t t, uint64_t *wbuf, uint64_t *rbuf, uint64_t bufsize, susrandom_result *res);
+void PrintRateResult(susrandom_params *params, susrandom_result *res);
+void PrintCPUResult(susrandom_result *res);
 int SustainedRandomAccess(susrandom_params *params);
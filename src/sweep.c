@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include "sweep.h"
+#include "drive.h"
+#include "histogram.h"
+#include "iobuf.h"
+#include "rng.h"
+#include "sus_random.h"
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// one row of the result matrix
+typedef struct {
+	int bs;
+	int qd;
+	int readpct;
+	uint64_t iops;
+	double mbps;
+	double p50;
+	double p99;
+	double p999;
+	double max;
+} sweep_cell;
+
+void init_sweep_params(sweep_params *p, char *drv, int *bs, int nbs, int *qd, int nqd, int *mix, int nmix, int duration,
+					   ioengine_type ioengine, int numjobs, dist_spec *dist, char *logfilepath) {
+	p->targetdrv = drv;
+	memcpy(p->bs, bs, sizeof(int) * nbs);
+	p->nbs = nbs;
+	memcpy(p->qd, qd, sizeof(int) * nqd);
+	p->nqd = nqd;
+	memcpy(p->mix, mix, sizeof(int) * nmix);
+	p->nmix = nmix;
+	p->durationsec = duration;
+	p->ioengine = ioengine;
+	p->numjobs = numjobs;
+	p->dist = *dist;
+	p->logfilepath = logfilepath;
+	if (logfilepath != NULL)
+		p->enablelogging = 1;
+	else
+		p->enablelogging = 0;
+}
+
+static void PrintSweepRow(FILE *f, const sweep_cell *c) {
+	fprintf(f, "%d\t%d\t%d\t%" PRIu64 "\t%.2f\t%.1f\t%.1f\t%.1f\t%.1f\n", c->bs, c->qd, c->readpct, c->iops, c->mbps, c->p50, c->p99,
+			c->p999, c->max);
+}
+
+int SweepAccess(sweep_params *params) {
+	int fd;
+	FILE *flog;
+	uint64_t *wbuf, *rbuf;
+	uint64_t t, physicalsectorsize, bufsize;
+	susrandom_params rp;
+	susrandom_result res;
+	sweep_cell *cells;
+	char distname[256];
+	int i, ib, iq, im, ncells, maxqd;
+	int buf_MB = 256;
+
+	t = 0;
+	physicalsectorsize = 0;
+
+	if (CheckIfBlockDevice(params->targetdrv) != 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "target is not a block device");
+		return -1;
+	}
+	if (getDriveSize(params->targetdrv, &t) != 0 || t < 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "getDriveSize failed");
+		return -1;
+	}
+	if (getPhysicalSectorSize(params->targetdrv, &physicalsectorsize) != 0 || physicalsectorsize < 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "getPhysicalSectorSize failed");
+		return -1;
+	}
+	if (t % physicalsectorsize != 0 || t == 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "target size is not a multiple of physical sector size or is zero");
+		return -1;
+	}
+
+	// check every cell up front so that a long sweep doesn't stop halfway
+	bufsize = (uint64_t)1024 * 1024 * buf_MB;
+	maxqd = 0;
+	for (iq = 0; iq < params->nqd; iq++)
+		if (params->qd[iq] > maxqd)
+			maxqd = params->qd[iq];
+	for (ib = 0; ib < params->nbs; ib++) {
+		if ((uint64_t)params->bs[ib] % physicalsectorsize != 0 || (uint64_t)params->bs[ib] < physicalsectorsize) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "block size is not a multiple of physical sector size");
+			return -1;
+		}
+		if (bufsize % params->bs[ib] != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "buffer size is not a multiple of block size");
+			return -1;
+		}
+		if (bufsize / params->numjobs / params->bs[ib] < (uint64_t)maxqd) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "numjobs * iodepth * block size doesn't fit in buffer");
+			return -1;
+		}
+	}
+
+	ncells = params->nbs * params->nqd * params->nmix;
+	cells = calloc(ncells, sizeof(sweep_cell));
+	if (cells == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "calloc for cells failed");
+		return -1;
+	}
+
+	// open target once, prepare buffers once
+	fd = open(params->targetdrv, O_RDWR | O_DIRECT);
+	if (fd == -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "open target failed");
+		return -1;
+	}
+	wbuf = iobuf_alloc(params->targetdrv, bufsize);
+	rbuf = iobuf_alloc(params->targetdrv, bufsize);
+	if (wbuf == NULL || rbuf == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for buffers failed");
+		return -1;
+	}
+	pcg32_fill(wbuf, bufsize, ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid());
+	memset(rbuf, '\0', bufsize);
+
+	// fire!
+	i = 0;
+	for (ib = 0; ib < params->nbs; ib++) {
+		for (iq = 0; iq < params->nqd; iq++) {
+			for (im = 0; im < params->nmix; im++, i++) {
+				init_susrandom_params(&rp, params->targetdrv, susr_rwmode_rw, params->bs[ib], params->durationsec, params->ioengine,
+									  params->qd[iq], params->numjobs, NULL);
+				rp.readpct = params->mix[im];
+				rp.dist = params->dist;
+				printf("[%d/%d] bs %d, iodepth %d, read %d %%\n", i + 1, ncells, params->bs[ib], params->qd[iq], params->mix[im]);
+				if (RandomRun(&rp, fd, t, wbuf, rbuf, bufsize, &res) != 0) {
+					printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "RandomRun failed");
+					return -1;
+				}
+				cells[i].bs = params->bs[ib];
+				cells[i].qd = params->qd[iq];
+				cells[i].readpct = params->mix[im];
+				cells[i].iops = (res.numios_r + res.numios_w) * 1000 / res.elapsed_ms;
+				cells[i].mbps = (double)(res.numios_r + res.numios_w) * params->bs[ib] / res.elapsed_ms / 1000;
+				cells[i].p50 = (double)hist_percentile(&res.hist, 50) / 1000;
+				cells[i].p99 = (double)hist_percentile(&res.hist, 99) / 1000;
+				cells[i].p999 = (double)hist_percentile(&res.hist, 99.9) / 1000;
+				cells[i].max = (double)res.hist.max / 1000;
+			}
+		}
+	}
+
+	// show matrix
+	printf("Target       : %s\n", params->targetdrv);
+	printf("IO Engine    : %s\n", ioengine_name(params->ioengine));
+	printf("Num Jobs     : %d\n", params->numjobs);
+	printf("Duration     : %d s per cell\n", params->durationsec);
+	dist_name(&params->dist, distname, sizeof(distname));
+	printf("Distribution : %s\n", distname);
+	printf("BS\tQD\tRead[%%]\tIOPS\tMB/s\tp50[us]\tp99[us]\tp99.9[us]\tmax[us]\n");
+	for (i = 0; i < ncells; i++)
+		PrintSweepRow(stdout, &cells[i]);
+	if (params->enablelogging) {
+		flog = fopen(params->logfilepath, "w");
+		if (flog == NULL) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fopen failed");
+			return -1;
+		}
+		fprintf(flog, "#BS\tQD\tRead[%%]\tIOPS\tMB/s\tp50[us]\tp99[us]\tp99.9[us]\tmax[us]\n");
+		for (i = 0; i < ncells; i++)
+			PrintSweepRow(flog, &cells[i]);
+		if (fclose(flog) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fclose failed");
+			return -1;
+		}
+	}
+
+	// finalize
+	free(cells);
+	iobuf_free(wbuf, bufsize);
+	iobuf_free(rbuf, bufsize);
+	if (close(fd) == -1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "close target failed");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "dist.h"
+#include "ioengine.h"
+
+#define SWEEP_MAX_VALUES 32
+
+typedef struct {
+	char *targetdrv;
+	int bs[SWEEP_MAX_VALUES];
+	int nbs;
+	int qd[SWEEP_MAX_VALUES];
+	int nqd;
+	int mix[SWEEP_MAX_VALUES]; // read percentage
+	int nmix;
+	int durationsec; // per cell
+	ioengine_type ioengine;
+	int numjobs;
+	dist_spec dist;
+	int enablelogging;
+	char *logfilepath; // table as tab separated values
+} sweep_params;
+
+void init_sweep_params(sweep_params *params, char *targetdrv, int *bs, int nbs, int *qd, int nqd, int *mix, int nmix, int duration,
+					   ioengine_type ioengine, int numjobs, dist_spec *dist, char *logfilepath);
+int SweepAccess(sweep_params *params);
@@ -1,5 +1,10 @@
+#define _GNU_SOURCE
 #include "tools.h"
+#include <ctype.h>
+#include <errno.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <sys/resource.h>
 #include <time.h>
 
 uint64_t getDiffMS(struct timespec start, struct timespec end) {
@@ -10,6 +15,31 @@ uint64_t getDiffNS(struct timespec start, struct timespec end) {
 	return (uint64_t)(end.tv_sec - start.tv_sec) * 1000 * 1000 * 1000 + end.tv_nsec - start.tv_nsec;
 }
 
+uint64_t getNowNS(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+	return (uint64_t)t.tv_sec * 1000 * 1000 * 1000 + t.tv_nsec;
+}
+
+static int quietprogress = 0;
+
+// multi-device runs share one log, the modes' \r progress and count down lines would only interleave there
+void setQuietProgress(int quiet) { quietprogress = quiet; }
+
+int isQuietProgress(void) { return quietprogress; }
+
+// cpu time consumed so far by the calling thread
+void getThreadCPUUS(uint64_t *user_us, uint64_t *sys_us) {
+	struct rusage ru;
+	if (getrusage(RUSAGE_THREAD, &ru) != 0) {
+		*user_us = 0;
+		*sys_us = 0;
+		return;
+	}
+	*user_us = (uint64_t)ru.ru_utime.tv_sec * 1000 * 1000 + (uint64_t)ru.ru_utime.tv_usec;
+	*sys_us = (uint64_t)ru.ru_stime.tv_sec * 1000 * 1000 + (uint64_t)ru.ru_stime.tv_usec;
+}
+
 hms getHMSfromMS(uint64_t ms) {
 	hms v;
 	v.h = (int)(ms / 1000 / 3600);
@@ -17,3 +47,117 @@ hms getHMSfromMS(uint64_t ms) {
 	v.s = (int)((ms / 1000 % 3600) % 60);
 	return v;
 }
+
+// "90d", "12h", "30m", "45s" or plain seconds, returns -1 if malformed
+int parseDurationSec(const char *str, uint64_t *sec) {
+	char *endptr;
+	uint64_t v, mul;
+	if (*str < '0' || *str > '9')
+		return -1;
+	v = strtoull(str, &endptr, 10);
+	switch (*endptr) {
+		case '\0':
+		case 's':
+			mul = 1;
+			break;
+		case 'm':
+			mul = 60;
+			break;
+		case 'h':
+			mul = 3600;
+			break;
+		case 'd':
+			mul = 86400;
+			break;
+		default:
+			return -1;
+	}
+	if (*endptr != '\0' && endptr[1] != '\0')
+		return -1;
+	// callers work in ns, the result must still fit then (about 584 years)
+	if (v > UINT64_MAX / 1000 / 1000 / 1000 / mul)
+		return -1;
+	*sec = v * mul;
+	return 0;
+}
+
+// "1,4,32" into out[], returns number of values or -1 if malformed or more than max
+int parseIntList(const char *str, int *out, int max) {
+	char *endptr;
+	long v;
+	int n = 0;
+	while (1) {
+		if (*str < '0' || *str > '9' || n == max)
+			return -1;
+		v = strtol(str, &endptr, 10);
+		if (v > 0x7fffffff)
+			return -1;
+		out[n++] = (int)v;
+		if (*endptr == '\0')
+			return n;
+		if (*endptr != ',')
+			return -1;
+		str = endptr + 1;
+	}
+}
+
+// bytes with optional k/m/g/t suffix (powers of 1024)
+int parseBytes(const char *str, uint64_t *v, char **endp) {
+	char *endptr;
+	int shift = 0;
+	if (*str < '0' || *str > '9')
+		return -1;
+	errno = 0;
+	*v = strtoull(str, &endptr, 10);
+	if (errno == ERANGE)
+		return -1;
+	switch (tolower((unsigned char)*endptr)) {
+		case 't':
+			shift += 10;
+			// fall through
+		case 'g':
+			shift += 10;
+			// fall through
+		case 'm':
+			shift += 10;
+			// fall through
+		case 'k':
+			shift += 10;
+			endptr++;
+			break;
+	}
+	if (*v > UINT64_MAX >> shift)
+		return -1;
+	*v <<= shift;
+	*endp = endptr;
+	return 0;
+}
+
+// like parseBytes but k/m/g are powers of 1000, for counts such as IOPS
+int parseCount(const char *str, uint64_t *v, char **endp) {
+	char *endptr;
+	uint64_t mul = 1;
+	if (*str < '0' || *str > '9')
+		return -1;
+	errno = 0;
+	*v = strtoull(str, &endptr, 10);
+	if (errno == ERANGE)
+		return -1;
+	switch (tolower((unsigned char)*endptr)) {
+		case 'g':
+			mul *= 1000;
+			// fall through
+		case 'm':
+			mul *= 1000;
+			// fall through
+		case 'k':
+			mul *= 1000;
+			endptr++;
+			break;
+	}
+	if (*v > UINT64_MAX / mul)
+		return -1;
+	*v *= mul;
+	*endp = endptr;
+	return 0;
+}
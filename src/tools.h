@@ -12,3 +12,11 @@ typedef struct {
 hms getHMSfromMS(uint64_t ms);
 uint64_t getDiffMS(struct timespec start, struct timespec end);
 uint64_t getDiffNS(struct timespec start, struct timespec end);
+uint64_t getNowNS(void);
+void setQuietProgress(int quiet);
+int isQuietProgress(void);
+void getThreadCPUUS(uint64_t *user_us, uint64_t *sys_us);
+int parseDurationSec(const char *str, uint64_t *sec);
+int parseIntList(const char *str, int *out, int max);
+int parseBytes(const char *str, uint64_t *v, char **endp);
+int parseCount(const char *str, uint64_t *v, char **endp);
@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include "affinity.h"
+#include "tools.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t trace_thread;
+static trace_ring *rings = NULL;
+static FILE *trace_file = NULL;
+static char *trace_path = NULL;
+static atomic_int trace_running = 0;
+static uint64_t trace_start_ns;
+static uint16_t trace_nextid = 0;
+static uint64_t trace_written = 0;
+static uint64_t trace_dropped = 0;
+static int trace_error = 0;
+
+// copy everything published so far, free rings whose engine has exited. caller holds trace_mutex
+static void DrainRings(void) {
+	trace_ring **pp = &rings;
+	trace_ring *r;
+	uint64_t head, tail, n;
+	int closed;
+
+	while ((r = *pp) != NULL) {
+		// closed first: once it is set the producer is done, so the head loaded after it is final
+		closed = atomic_load(&r->closed);
+		head = atomic_load_explicit(&r->head, memory_order_acquire);
+		tail = r->tail;
+		while (tail != head) {
+			// contiguous part up to the end of the array
+			n = head - tail;
+			if (n > TRACE_RING_SIZE - (tail & (TRACE_RING_SIZE - 1)))
+				n = TRACE_RING_SIZE - (tail & (TRACE_RING_SIZE - 1));
+			if (fwrite(&r->recs[tail & (TRACE_RING_SIZE - 1)], sizeof(trace_record), n, trace_file) != n && !trace_error) {
+				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "trace write failed");
+				trace_error = 1;
+			}
+			tail += n;
+			trace_written += n;
+		}
+		atomic_store_explicit(&r->tail, tail, memory_order_release);
+		if (closed) {
+			trace_dropped += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+			*pp = r->next;
+			free(r);
+		} else {
+			pp = &r->next;
+		}
+	}
+}
+
+void *TraceWriter(void *p) {
+	(void)p;
+	affinity_pin_helper();
+	while (atomic_load(&trace_running)) {
+		usleep(TRACE_FLUSH_US);
+		pthread_mutex_lock(&trace_mutex);
+		DrainRings();
+		pthread_mutex_unlock(&trace_mutex);
+	}
+	return NULL;
+}
+
+int trace_start(const char *path) {
+	trace_header hdr;
+	struct timespec ts;
+
+	trace_file = fopen(path, "w");
+	if (trace_file == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "fopen failed");
+		return -1;
+	}
+	setvbuf(trace_file, NULL, _IOFBF, 1 << 20);
+	trace_path = strdup(path);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION;
+	hdr.recsize = sizeof(trace_record);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	trace_start_ns = getNowNS();
+	hdr.start_realtime_ns = (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + (uint64_t)ts.tv_nsec;
+	if (fwrite(&hdr, sizeof(hdr), 1, trace_file) != 1) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "trace header write failed");
+		return -1;
+	}
+
+	atomic_store(&trace_running, 1);
+	if (pthread_create(&trace_thread, NULL, TraceWriter, NULL) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
+		atomic_store(&trace_running, 0);
+		return -1;
+	}
+	return 0;
+}
+
+// drains what is left, also rings of engines that never exited
+int trace_stop(void) {
+	trace_ring *r;
+
+	if (trace_file == NULL)
+		return 0;
+	atomic_store(&trace_running, 0);
+	pthread_join(trace_thread, NULL);
+	pthread_mutex_lock(&trace_mutex);
+	for (r = rings; r != NULL; r = r->next)
+		atomic_store(&r->closed, 1);
+	DrainRings();
+	pthread_mutex_unlock(&trace_mutex);
+	if (fclose(trace_file) != 0 && !trace_error) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "trace close failed");
+		trace_error = 1;
+	}
+	trace_file = NULL;
+
+	printf("Trace File           = %s\n", trace_path);
+	printf("Trace Records        = %" PRIu64 "\n", trace_written);
+	printf("Trace Dropped        = %" PRIu64 "\n", trace_dropped);
+	free(trace_path);
+	return trace_error ? -1 : 0;
+}
+
+// NULL when not tracing
+trace_ring *trace_attach(void) {
+	trace_ring *r;
+
+	if (!atomic_load(&trace_running))
+		return NULL;
+	r = aligned_alloc(64, sizeof(trace_ring));
+	if (r == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc for trace ring failed, not traced");
+		return NULL;
+	}
+	memset(r, 0, offsetof(trace_ring, recs));
+	r->start_ns = trace_start_ns;
+	pthread_mutex_lock(&trace_mutex);
+	r->id = trace_nextid++;
+	r->next = rings;
+	rings = r;
+	pthread_mutex_unlock(&trace_mutex);
+	return r;
+}
+
+// the writer frees the ring once it is drained
+void trace_detach(trace_ring *r) {
+	if (r != NULL)
+		atomic_store(&r->closed, 1);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// per-IO trace: every engine pushes one record per completion into its own single producer/single consumer
+// ring, a background thread streams the rings into the trace file. a full ring drops records (counted)
+// instead of stalling the IO thread
+
+#define TRACE_MAGIC "DXTRACE1"
+#define TRACE_VERSION 1
+#define TRACE_RING_SIZE 65536 // records per engine, power of two
+#define TRACE_FLUSH_US 10000  // writer drains the rings this often
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t recsize;
+	uint64_t start_realtime_ns; // wall clock at ts_ns == 0
+} trace_header;
+
+typedef struct {
+	uint64_t ts_ns; // completion, from trace start
+	uint64_t lba;	// 512 byte sectors
+	uint64_t lat_ns;
+	uint32_t len;	 // requested bytes
+	uint16_t thread; // engine instance, in order of ioengine_init
+	uint8_t op;		 // io_op
+	uint8_t err;	 // errno of a failed request, 0 otherwise
+} trace_record;
+
+_Static_assert(sizeof(trace_record) == 32, "trace_record must stay 32 bytes");
+
+typedef struct trace_ring {
+	_Alignas(64) uint64_t head; // producer
+	uint64_t dropped;
+	_Alignas(64) uint64_t tail; // consumer
+	uint64_t start_ns;
+	uint16_t id;
+	int closed;
+	struct trace_ring *next;
+	_Alignas(64) trace_record recs[TRACE_RING_SIZE];
+} trace_ring;
+
+int trace_start(const char *path);
+int trace_stop(void);
+trace_ring *trace_attach(void);
+void trace_detach(trace_ring *r);
+
+// called by the ring's owner thread only
+static inline void trace_push(trace_ring *r, uint64_t now_ns, uint64_t offset, uint32_t len, uint8_t op, int64_t res,
+							  uint64_t lat_ns) {
+	uint64_t head = r->head;
+	trace_record *rec;
+
+	if (head - atomic_load_explicit(&r->tail, memory_order_acquire) >= TRACE_RING_SIZE) {
+		atomic_store_explicit(&r->dropped, r->dropped + 1, memory_order_relaxed);
+		return;
+	}
+	rec = &r->recs[head & (TRACE_RING_SIZE - 1)];
+	rec->ts_ns = now_ns - r->start_ns;
+	rec->lba = offset >> 9;
+	rec->lat_ns = lat_ns;
+	rec->len = len;
+	rec->thread = r->id;
+	rec->op = op;
+	rec->err = res < 0 ? (uint8_t)-res : 0;
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
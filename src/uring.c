@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// minimal io_uring wrapper over raw syscalls, no liburing required
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) { return (int)syscall(__NR_io_uring_setup, entries, p); }
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// flags: IORING_SETUP_IOPOLL and/or IORING_SETUP_SQPOLL, 0 for interrupt driven completions
+int uring_init(uring_t *r, unsigned entries, unsigned flags) {
+	struct io_uring_params p;
+
+	memset(r, 0, sizeof(uring_t));
+	memset(&p, 0, sizeof(p));
+	p.flags = flags;
+	if (flags & IORING_SETUP_SQPOLL)
+		p.sq_thread_idle = 1000; // ms without submissions before the kernel thread sleeps
+	r->ringfd = sys_io_uring_setup(entries, &p);
+	if (r->ringfd < 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "io_uring_setup failed");
+		return -1;
+	}
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_size > r->sq_size)
+			r->sq_size = r->cq_size;
+		r->cq_size = r->sq_size;
+	}
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ringfd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mmap sq ring failed");
+		close(r->ringfd);
+		return -1;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ringfd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mmap cq ring failed");
+			munmap(r->sq_ptr, r->sq_size);
+			close(r->ringfd);
+			return -1;
+		}
+	}
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ringfd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mmap sqes failed");
+		if (r->cq_ptr != r->sq_ptr)
+			munmap(r->cq_ptr, r->cq_size);
+		munmap(r->sq_ptr, r->sq_size);
+		close(r->ringfd);
+		return -1;
+	}
+
+	r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+	r->sq_flags = (unsigned *)((char *)r->sq_ptr + p.sq_off.flags);
+	r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+	r->sq_entries = p.sq_entries;
+	r->sqe_tail = *r->sq_tail;
+	r->to_submit = 0;
+	r->flags = flags;
+	return 0;
+}
+
+void uring_exit(uring_t *r) {
+	munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+	munmap(r->sq_ptr, r->sq_size);
+	close(r->ringfd);
+}
+
+int uring_register_files(uring_t *r, int *fds, unsigned nr) {
+	if (sys_io_uring_register(r->ringfd, IORING_REGISTER_FILES, fds, nr) < 0)
+		return -1;
+	return 0;
+}
+
+int uring_register_buffers(uring_t *r, struct iovec *iov, unsigned nr) {
+	if (sys_io_uring_register(r->ringfd, IORING_REGISTER_BUFFERS, iov, nr) < 0)
+		return -1;
+	return 0;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *r) {
+	struct io_uring_sqe *sqe;
+	unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	unsigned idx;
+
+	if (r->sqe_tail - head >= r->sq_entries)
+		return NULL; // sq full
+	idx = r->sqe_tail & *r->sq_mask;
+	r->sq_array[idx] = idx;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	r->sqe_tail++;
+	r->to_submit++;
+	return sqe;
+}
+
+void uring_prep_rw(struct io_uring_sqe *sqe, int opcode, int fd, void *addr, unsigned len, uint64_t offset, uint64_t user_data) {
+	sqe->opcode = (uint8_t)opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)addr;
+	sqe->len = len;
+	sqe->off = offset;
+	sqe->user_data = user_data;
+}
+
+// with IOPOLL completions are only found by entering the kernel, so every call polls once even if
+// wait_nr is 0. with SQPOLL the kernel thread picks up the new tail itself and the syscall is skipped
+// unless it went idle or we have to wait
+int uring_submit_and_wait(uring_t *r, unsigned wait_nr) {
+	int ret;
+	unsigned flags = 0;
+	unsigned submitted;
+
+	__atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+	if (wait_nr > 0 || (r->flags & IORING_SETUP_IOPOLL))
+		flags |= IORING_ENTER_GETEVENTS;
+	if (r->flags & IORING_SETUP_SQPOLL) {
+		submitted = r->to_submit;
+		r->to_submit = 0;
+		__atomic_thread_fence(__ATOMIC_SEQ_CST); // order the tail store before reading the wakeup flag
+		if (__atomic_load_n(r->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+			flags |= IORING_ENTER_SQ_WAKEUP;
+		if (wait_nr == 0)
+			flags &= ~IORING_ENTER_GETEVENTS; // the kernel thread polls for IOPOLL rings too
+		if (flags == 0)
+			return (int)submitted;
+		do {
+			ret = sys_io_uring_enter(r->ringfd, 0, wait_nr, flags);
+		} while (ret < 0 && errno == EINTR);
+		if (ret < 0)
+			return -1;
+		return (int)submitted;
+	}
+	do {
+		ret = sys_io_uring_enter(r->ringfd, r->to_submit, wait_nr, flags);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+	r->to_submit -= (unsigned)ret;
+	return ret;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *r) {
+	unsigned head = *r->cq_head;
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &r->cqes[head & *r->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *r) { __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE); }
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+typedef struct {
+	int ringfd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *sq_flags;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqes_size;
+	unsigned sq_entries;
+	unsigned sqe_tail; // local tail, published on submit
+	unsigned to_submit;
+	unsigned flags; // IORING_SETUP_* given to uring_init()
+} uring_t;
+
+int uring_init(uring_t *ring, unsigned entries, unsigned flags);
+void uring_exit(uring_t *ring);
+int uring_register_files(uring_t *ring, int *fds, unsigned nr);
+int uring_register_buffers(uring_t *ring, struct iovec *iov, unsigned nr);
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+void uring_prep_rw(struct io_uring_sqe *sqe, int opcode, int fd, void *addr, unsigned len, uint64_t offset, uint64_t user_data);
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr);
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+void uring_cqe_seen(uring_t *ring);
@@ -1,8 +1,14 @@
 #define _GNU_SOURCE
 #define _LARGEFILE64_SOURCE
 #include "verify.h"
+#include "affinity.h"
+#include "compare.h"
 #include "drive.h"
+#include "ioengine.h"
+#include "iobuf.h"
 #include "rng.h"
+#include "stamp.h"
+#include "crc32c.h"
 #include "tools.h"
 #include <errno.h>
 #include <fcntl.h>
@@ -15,6 +21,9 @@
 #include <time.h>
 #include <unistd.h>
 
+#define VERIFY_MAX_MISMATCH 65536 // recorded per chunk
+#define VERIFY_MAX_PRINT 16		  // printed per chunk
+
 typedef struct {
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
@@ -22,20 +31,54 @@ typedef struct {
 	uint64_t total;
 } progression;
 
-void init_verify_params(verify_params *p, char *drv, int bufsize_MB) {
+// read phase pipeline: rbuf is split into two halves, the reader fills one
+// while the compare thread checks the other against wbuf
+typedef struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint64_t *wbuf; // random: written data, lba: expected data of the chunk being compared, stamp: one sector scratch
+	uint64_t *rbuf;
+	verify_pattern pattern;
+	uint64_t seed;
+	uint64_t generation;
+	uint64_t bufsize;
+	uint64_t chunksize; // half of bufsize
+	uint64_t physicalsectorsize;
+	int full[2];
+	uint64_t pos[2]; // disk position of each half
+	uint64_t len[2]; // valid bytes in each half
+	int done;
+	int abort; // reader failed, stop without comparing the rest
+	sector_mismatch *mismatches;
+	uint64_t tcomp;
+	uint64_t numdiffers;
+	uint64_t biterrors;
+	uint64_t nclass[stamp_nclass];
+} comparer;
+
+void init_verify_params(verify_params *p, char *drv, int bufsize_MB, ioengine_type ioengine, int iodepth, verify_pattern pattern,
+						uint64_t seed, uint64_t generation, int readonly) {
 	p->targetdrv = drv;
 	p->bufsize_MB = bufsize_MB;
+	p->ioengine = ioengine;
+	p->iodepth = iodepth;
+	p->pattern = pattern;
+	p->seed = seed;
+	p->generation = generation;
+	p->readonly = readonly;
 }
 
 void *PrintVerifyProgression(void *p) {
 	struct timespec t;
 	progression *prog = p;
+	affinity_pin_helper();
 	if (pthread_mutex_lock(&prog->mutex) != 0) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex lock failed");
 		return NULL;
 	}
 	while (1) {
-		printf("\r%.2f %% Completed", (double)prog->current / prog->total * 100);
+		if (!isQuietProgress())
+			printf("\r%.2f %% Completed", (double)prog->current / prog->total * 100);
 		clock_gettime(CLOCK_REALTIME, &t);
 		t.tv_sec++; // update every seconds
 		if (pthread_cond_timedwait(&prog->cond, &prog->mutex, &t) != ETIMEDOUT)
@@ -51,15 +94,133 @@ void *PrintVerifyProgression(void *p) {
 	return NULL;
 }
 
+static int StopVerifyProgression(progression *prog, pthread_t pth) {
+	if (pthread_mutex_lock(&prog->mutex) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex lock failed");
+		return -1;
+	}
+	if (pthread_cond_signal(&prog->cond) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "signaling failed");
+		return -1;
+	}
+	if (pthread_mutex_unlock(&prog->mutex) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex unlock failed");
+		return -1;
+	}
+	if (pthread_join(pth, NULL) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
+		return -1;
+	}
+	return 0;
+}
+
+// stamp pattern: every sector is checked on its own and failures are classified
+static void CheckStamps(comparer *cmp, const uint64_t *act, uint64_t pos, uint64_t len) {
+	uint64_t s, lba, biterrors, nfail = 0, chunkbits = 0;
+	uint64_t words = cmp->physicalsectorsize / sizeof(uint64_t);
+	stamp_header h;
+	stamp_class c;
+	time_t ts;
+	struct tm tm;
+	char when[32];
+
+	for (s = 0; s < len / cmp->physicalsectorsize; s++) {
+		lba = pos / cmp->physicalsectorsize + s;
+		c = stamp_check(act + s * words, lba, cmp->physicalsectorsize, cmp->seed, cmp->generation, cmp->wbuf, &h, &biterrors);
+		cmp->nclass[c]++;
+		if (c == stamp_ok)
+			continue;
+		if (nfail < VERIFY_MAX_PRINT) {
+			printf("\n*** Sector # %" PRIu64 " %s", lba, stamp_class_name(c));
+			if (c == stamp_misdirected || c == stamp_stale || c == stamp_foreign) {
+				ts = (time_t)(h.ts_ns / 1000 / 1000 / 1000);
+				localtime_r(&ts, &tm);
+				strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+				printf(" (stamp of sector # %" PRIu64 ", run %" PRIu64 ", generation %" PRIu64 ", written %s)", h.lba, h.runid, h.gen, when);
+			} else if (c == stamp_corrupt || c == stamp_torn) {
+				printf(" (%" PRIu64 " bit errors)", biterrors);
+			}
+			printf("\n");
+		}
+		nfail++;
+		chunkbits += biterrors;
+	}
+	if (nfail > 0) {
+		printf("\n*** %" PRIu64 " sectors failed in %" PRIu64 " bytes from Position %" PRIu64 "\n", nfail, len, pos);
+		cmp->numdiffers += nfail;
+		cmp->biterrors += chunkbits;
+	}
+}
+
+// random and lba patterns: compare against the expected data of the chunk
+static void CompareChunk(comparer *cmp, const uint64_t *exp, const uint64_t *act, uint64_t pos, uint64_t len) {
+	uint64_t n, i, at, biterrors;
+
+	// whole chunk in one pass, then report what was found
+	n = CompareSectors(exp, act, len, cmp->physicalsectorsize, cmp->mismatches, VERIFY_MAX_MISMATCH);
+	if (n > 0) {
+		biterrors = 0;
+		for (i = 0; i < n && i < VERIFY_MAX_MISMATCH; i++) {
+			biterrors += cmp->mismatches[i].biterrors;
+			if (i < VERIFY_MAX_PRINT) {
+				at = pos + cmp->mismatches[i].sector * cmp->physicalsectorsize;
+				printf("\n*** Differ at Position %" PRIu64 " (sector # %" PRIu64 ", %" PRIu64 " bit errors)\n", at,
+					   at / cmp->physicalsectorsize, cmp->mismatches[i].biterrors);
+			}
+		}
+		printf("\n*** %" PRIu64 " sectors differ in %" PRIu64 " bytes from Position %" PRIu64 " (%" PRIu64 " bit errors%s)\n", n, len, pos,
+			   biterrors, n > VERIFY_MAX_MISMATCH ? " in recorded sectors" : "");
+		cmp->numdiffers += n;
+		cmp->biterrors += biterrors;
+	}
+}
+
+void *CompareChunks(void *p) {
+	comparer *cmp = p;
+	uint64_t *act;
+	int idx = 0;
+	affinity_pin_io(1);
+	while (1) {
+		pthread_mutex_lock(&cmp->mutex);
+		while (!cmp->full[idx] && !cmp->done && !cmp->abort)
+			pthread_cond_wait(&cmp->cond, &cmp->mutex);
+		if (!cmp->full[idx] || cmp->abort) { // done and nothing left, or the reader failed
+			pthread_mutex_unlock(&cmp->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&cmp->mutex);
+
+		act = &cmp->rbuf[cmp->chunksize * idx / sizeof(uint64_t)];
+		if (cmp->pattern == verify_pattern_stamp) {
+			CheckStamps(cmp, act, cmp->pos[idx], cmp->len[idx]);
+		} else if (cmp->pattern == verify_pattern_lba) {
+			lbapattern_fill(cmp->wbuf, cmp->len[idx], cmp->pos[idx], cmp->physicalsectorsize, cmp->seed);
+			CompareChunk(cmp, cmp->wbuf, act, cmp->pos[idx], cmp->len[idx]);
+		} else {
+			CompareChunk(cmp, &cmp->wbuf[cmp->pos[idx] % cmp->bufsize / sizeof(uint64_t)], act, cmp->pos[idx], cmp->len[idx]);
+		}
+		cmp->tcomp += cmp->len[idx];
+
+		pthread_mutex_lock(&cmp->mutex);
+		cmp->full[idx] = 0;
+		pthread_cond_broadcast(&cmp->cond);
+		pthread_mutex_unlock(&cmp->mutex);
+		idx ^= 1;
+	}
+	return NULL;
+}
+
 int VerifyDisk(verify_params *params) {
 	int fd;
 	uint64_t *wbuf, *rbuf;
-	pcg32x2_random_t rng;
-	uint64_t c, t, ptr, ptrtmp, tcomp, ms, numdiffers, physicalsectorsize, buf_MB;
-	ssize_t retval;
+	uint64_t c, t, len, ms, physicalsectorsize, buf_MB;
+	int idx, ret;
+	ioengine e;
 	struct timespec tsa, tsb;
-	pthread_t pth;
+	pthread_t pth, pth_cmp;
 	progression prog;
+	comparer cmp;
+	char label[32];
 	t = 0;
 	physicalsectorsize = 0;
 	wbuf = NULL;
@@ -91,89 +252,122 @@ int VerifyDisk(verify_params *params) {
 		return -1;
 	}
 
-	// prepare buffer and random data to wbuf
+	// prepare buffer and random data to wbuf, lba and stamp patterns are generated per chunk instead
 	buf_MB = params->bufsize_MB;
-	if (buf_MB < 100) {
+	if (buf_MB < (params->pattern != verify_pattern_random ? 2 : 100) || 1024 * 1024 * buf_MB / 2 % physicalsectorsize != 0) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "too small buffer size");
 		return -1;
 	}
 	clock_gettime(CLOCK_MONOTONIC_RAW, &tsa);
-	if (posix_memalign((void **)&wbuf, 1024 * 1024, 1024 * 1024 * buf_MB) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "memalign for wbuf failed");
+	wbuf = iobuf_alloc(params->targetdrv, 1024 * 1024 * buf_MB);
+	if (wbuf == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for wbuf failed");
 		return -1;
 	}
-	if (posix_memalign((void **)&rbuf, 1024 * 1024, 1024 * 1024 * buf_MB) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "memalign for rbuf failed");
+	rbuf = iobuf_alloc(params->targetdrv, 1024 * 1024 * buf_MB);
+	if (rbuf == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "iobuf_alloc for rbuf failed");
 		return -1;
 	}
-	pcg32x2_srandom_r(&rng, 42u, 42u, 54u, 54u);
-	pcg32x2_srandom_r(&rng, time(NULL), time(NULL), (intptr_t)&rng, (intptr_t)&rng);
-	for (ptr = 0; ptr < 1024 * 1024 * buf_MB / sizeof(uint64_t); ptr++) {
-		wbuf[ptr] = pcg32x2_random_r(&rng);
+	if (params->pattern == verify_pattern_random) {
+		pcg32_fill(wbuf, 1024 * 1024 * buf_MB, ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid());
+	} else if (params->pattern == verify_pattern_lba) {
+		printf("LBA Pattern Seed = %" PRIu64 "\n", params->seed);
+	} else {
+		if (physicalsectorsize < sizeof(stamp_header) || physicalsectorsize % STAMP_BLOCK != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "physical sector size doesn't fit the stamp pattern");
+			return -1;
+		}
+		printf("Stamp Run ID     = %" PRIu64 "\n", params->seed);
+		if (params->generation != 0)
+			printf("Stamp Generation = %" PRIu64 "\n", params->generation);
+		else
+			puts("Stamp Generation = any");
+		printf("Stamp Checksum   = crc32c (%s)\n", crc32c_impl());
 	}
 	memset(rbuf, '\0', 1024 * 1024 * buf_MB);
 	clock_gettime(CLOCK_MONOTONIC_RAW, &tsb);
 	printf("Preparation of Memory (%" PRIu64 " MB) - %" PRIu64 " ms\n", buf_MB, getDiffMS(tsa, tsb));
 
-	// create another thread for write progression monitoring, mutex lock required when accessing prog
-	puts("Start Writing...");
+	// this thread does the IO from here on
+	affinity_pin_io(0);
+	if (ioengine_init(&e, params->ioengine, fd, params->iodepth) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "ioengine_init failed");
+		return -1;
+	}
+
 	pthread_mutex_init(&prog.mutex, NULL);
 	pthread_cond_init(&prog.cond, NULL);
-	if (pthread_create(&pth, NULL, PrintVerifyProgression, &prog) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
-	}
+	if (params->readonly) {
+		puts("Read only, skip writing...");
+	} else {
+		// create another thread for write progression monitoring, mutex lock required when accessing prog
+		puts("Start Writing...");
+		if (pthread_create(&pth, NULL, PrintVerifyProgression, &prog) != 0) {
+			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
+		}
 
-	// write!
-	clock_gettime(CLOCK_MONOTONIC_RAW, &tsa);
-	ptr = 0;
-	for (c = 0; c < t;) {
-		retval = write(fd, &wbuf[ptr], 1024 * 1024);
-		if (retval == -1 || retval == 0) {
-			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "write error");
-			return -1;
+		// write!
+		clock_gettime(CLOCK_MONOTONIC_RAW, &tsa);
+		for (c = 0; c < t;) {
+			len = 1024 * 1024 * buf_MB;
+			if (len > t - c)
+				len = t - c;
+			if (params->pattern == verify_pattern_lba)
+				lbapattern_fill(wbuf, len, c, physicalsectorsize, params->seed);
+			else if (params->pattern == verify_pattern_stamp)
+				stamp_fill(wbuf, len, c, physicalsectorsize, params->seed, params->generation);
+			if (ioengine_transfer(&e, io_op_write, wbuf, len, c, 1024 * 1024, &prog.current, NULL) != 0) {
+				printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "write error");
+				StopVerifyProgression(&prog, pth);
+				ioengine_exit(&e);
+				iobuf_free(wbuf, 1024 * 1024 * buf_MB);
+				iobuf_free(rbuf, 1024 * 1024 * buf_MB);
+				close(fd);
+				return -1;
+			}
+			c += len;
 		}
-		atomic_fetch_add(&prog.current, retval);
-		c += retval;
-		ptr += retval / sizeof(uint64_t);
-		if (ptr == 1024 * 1024 * buf_MB / sizeof(uint64_t))
-			ptr = 0;
-	}
 
-	// write finished, stop progression monitoring thread
-	clock_gettime(CLOCK_MONOTONIC_RAW, &tsb);
-	if (pthread_mutex_lock(&prog.mutex) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex lock failed");
-		return -1;
-	}
-	if (pthread_cond_signal(&prog.cond) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "signaling failed");
-		return -1;
-	}
-	if (pthread_mutex_unlock(&prog.mutex) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex unlock failed");
-		return -1;
-	}
-	if (pthread_join(pth, NULL) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
-		return -1;
-	}
+		// write finished, stop progression monitoring thread
+		clock_gettime(CLOCK_MONOTONIC_RAW, &tsb);
+		if (StopVerifyProgression(&prog, pth) != 0)
+			return -1;
 
-	// show statistical result
-	ms = getDiffMS(tsa, tsb);
-	printf("Write Operation  - %" PRIu64 " ms (%d h %d m %d s)\n", ms, getHMSfromMS(ms).h, getHMSfromMS(ms).m, getHMSfromMS(ms).s);
-	printf("Write Throughput - %.2f MB/s\n", (double)t / ms / 1000);
+		// show statistical result
+		ms = getDiffMS(tsa, tsb);
+		printf("Write Operation  - %" PRIu64 " ms (%d h %d m %d s)\n", ms, getHMSfromMS(ms).h, getHMSfromMS(ms).m, getHMSfromMS(ms).s);
+		printf("Write Throughput - %.2f MB/s\n", (double)t / ms / 1000);
 
-	// wait...
-	puts("Sleep for 30 seconds...");
-	sleep(30);
+		// wait...
+		puts("Sleep for 30 seconds...");
+		sleep(30);
+	}
 
 	// read & compare!
 	puts("Start Reading...");
 	prog.current = 0;
-	tcomp = 0;
-	numdiffers = 0;
-	if (lseek64(fd, 0, SEEK_SET) == -1) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "lseek to 0 failed");
+	pthread_mutex_init(&cmp.mutex, NULL);
+	pthread_cond_init(&cmp.cond, NULL);
+	cmp.wbuf = wbuf;
+	cmp.rbuf = rbuf;
+	cmp.pattern = params->pattern;
+	cmp.seed = params->seed;
+	cmp.generation = params->generation;
+	cmp.bufsize = 1024 * 1024 * buf_MB;
+	cmp.chunksize = cmp.bufsize / 2;
+	cmp.physicalsectorsize = physicalsectorsize;
+	cmp.full[0] = 0;
+	cmp.full[1] = 0;
+	cmp.done = 0;
+	cmp.abort = 0;
+	cmp.tcomp = 0;
+	cmp.numdiffers = 0;
+	cmp.biterrors = 0;
+	memset(cmp.nclass, 0, sizeof(cmp.nclass));
+	cmp.mismatches = malloc(sizeof(sector_mismatch) * VERIFY_MAX_MISMATCH);
+	if (cmp.mismatches == NULL) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "malloc for mismatches failed");
 		return -1;
 	}
 
@@ -182,46 +376,62 @@ int VerifyDisk(verify_params *params) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
 	}
 
+	// create another thread for compare, mutex lock required when accessing cmp.full/done
+	if (pthread_create(&pth_cmp, NULL, CompareChunks, &cmp) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "create thread failed");
+		return -1;
+	}
+
 	clock_gettime(CLOCK_MONOTONIC_RAW, &tsa);
-	ptr = 0;
+	idx = 0;
+	ret = 0;
 	for (c = 0; c < t;) {
-		retval = read(fd, &rbuf[ptr], 1024 * 1024);
-		if (retval == -1 || retval == 0) {
+		len = cmp.chunksize;
+		if (len > t - c)
+			len = t - c;
+		// wait until the compare thread releases this half
+		pthread_mutex_lock(&cmp.mutex);
+		while (cmp.full[idx])
+			pthread_cond_wait(&cmp.cond, &cmp.mutex);
+		pthread_mutex_unlock(&cmp.mutex);
+		if (ioengine_transfer(&e, io_op_read, &rbuf[cmp.chunksize * idx / sizeof(uint64_t)], len, c, 1024 * 1024, &prog.current, NULL) !=
+			0) {
 			printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "read error");
-			return -1;
-		}
-		atomic_fetch_add(&prog.current, retval);
-		c += retval;
-		ptr += retval / sizeof(uint64_t);
-		if (ptr == 1024 * 1024 * buf_MB / sizeof(uint64_t) || c == t) {
-			ptrtmp = ptr;
-			for (ptr = 0; ptr < ptrtmp; ptr += physicalsectorsize / sizeof(uint64_t)) {
-				if (memcmp(&wbuf[ptr], &rbuf[ptr], physicalsectorsize) != 0) {
-					printf("\n*** Differ at Position %" PRIu64 " (sector # %" PRIu64 ")\n", tcomp, tcomp / physicalsectorsize);
-					numdiffers++;
-				}
-				tcomp += physicalsectorsize;
-			}
-			ptr = 0;
+			pthread_mutex_lock(&cmp.mutex);
+			cmp.abort = 1;
+			pthread_cond_broadcast(&cmp.cond);
+			pthread_mutex_unlock(&cmp.mutex);
+			ret = -1;
+			break;
 		}
+		pthread_mutex_lock(&cmp.mutex);
+		cmp.pos[idx] = c;
+		cmp.len[idx] = len;
+		cmp.full[idx] = 1;
+		pthread_cond_broadcast(&cmp.cond);
+		pthread_mutex_unlock(&cmp.mutex);
+		c += len;
+		idx ^= 1;
 	}
-
-	// read finished, stop progression monitoring thread
-	clock_gettime(CLOCK_MONOTONIC_RAW, &tsb);
-	if (pthread_mutex_lock(&prog.mutex) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex lock failed");
-		return -1;
-	}
-	if (pthread_cond_signal(&prog.cond) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "signaling failed");
+	pthread_mutex_lock(&cmp.mutex);
+	cmp.done = 1;
+	pthread_cond_broadcast(&cmp.cond);
+	pthread_mutex_unlock(&cmp.mutex);
+	if (pthread_join(pth_cmp, NULL) != 0) {
+		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
 		return -1;
 	}
-	if (pthread_mutex_unlock(&prog.mutex) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "mutex unlock failed");
+
+	// read finished or failed, stop progression monitoring thread either way
+	clock_gettime(CLOCK_MONOTONIC_RAW, &tsb);
+	if (StopVerifyProgression(&prog, pth) != 0)
 		return -1;
-	}
-	if (pthread_join(pth, NULL) != 0) {
-		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "pthread join failed");
+	if (ret != 0) {
+		ioengine_exit(&e);
+		free(cmp.mismatches);
+		iobuf_free(wbuf, 1024 * 1024 * buf_MB);
+		iobuf_free(rbuf, 1024 * 1024 * buf_MB);
+		close(fd);
 		return -1;
 	}
 
@@ -231,17 +441,28 @@ int VerifyDisk(verify_params *params) {
 	printf("Read  Throughput - %.2f MB/s\n", (double)t / ms / 1000);
 	printf("Target               = %s\n", params->targetdrv);
 	printf("Target Device Size   = %" PRIu64 "\n", t);
-	printf("Total Compared Bytes = %" PRIu64 "\n", tcomp);
-	if (numdiffers > 0)
-		printf("*** %" PRIu64 " Differ Detected! ***\n", numdiffers);
+	printf("Total Compared Bytes = %" PRIu64 "\n", cmp.tcomp);
+	if (params->pattern == verify_pattern_stamp) {
+		for (idx = stamp_unwritten; idx < stamp_nclass; idx++) {
+			if (cmp.nclass[idx] == 0)
+				continue;
+			snprintf(label, sizeof(label), "%s Sectors", stamp_class_name((stamp_class)idx));
+			printf("%-20s = %" PRIu64 "\n", label, cmp.nclass[idx]);
+		}
+	}
+	if (cmp.numdiffers > 0) {
+		printf("Total Bit Errors     = %" PRIu64 "\n", cmp.biterrors);
+		printf("Differ Sector Rate   = %.3g\n", (double)cmp.numdiffers * physicalsectorsize / cmp.tcomp);
+		printf("*** %" PRIu64 " Differ Detected! ***\n", cmp.numdiffers);
+	}
 	else
 		printf("*** No Differ Detected ***\n");
 
 	// finalize
-	if (wbuf != NULL)
-		free(wbuf);
-	if (rbuf != NULL)
-		free(rbuf);
+	ioengine_exit(&e);
+	free(cmp.mismatches);
+	iobuf_free(wbuf, 1024 * 1024 * buf_MB);
+	iobuf_free(rbuf, 1024 * 1024 * buf_MB);
 	if (close(fd) == -1) {
 		printf("%s:%d %s(): %s\n", __FILE__, __LINE__, __func__, "close target failed");
 		return -1;
@@ -1,9 +1,26 @@
 #pragma once
 
+#include "ioengine.h"
+#include <stdint.h>
+
+typedef enum { //
+	verify_pattern_random,
+	verify_pattern_lba,
+	verify_pattern_stamp,
+	verify_pattern_undefined
+} verify_pattern;
+
 typedef struct {
 	char *targetdrv;
 	int bufsize_MB;
+	ioengine_type ioengine;
+	int iodepth;
+	verify_pattern pattern;
+	uint64_t seed;		 // lba pattern seed, stamp run id
+	uint64_t generation; // stamp only, 0: any when checking
+	int readonly;
 } verify_params;
 
-void init_verify_params(verify_params *params, char *targetdrv, int bufsize_MB);
+void init_verify_params(verify_params *params, char *targetdrv, int bufsize_MB, ioengine_type ioengine, int iodepth, verify_pattern pattern,
+						uint64_t seed, uint64_t generation, int readonly);
 int VerifyDisk(verify_params *params);